@@ -6,6 +6,20 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "mandelbrot.h"
+#include "sound.h"
+#include "audio_output.h"
+#include "formula_jit.h"
+#include "overlay.h"
+#include "palette.h"
+#include "render_stats.h"
+#include "tile_render.h"
+#include "trace.h"
+#include "view.h"
 
 // Constants for the window and rendering
 const int SCREEN_WIDTH = 800;
@@ -16,217 +30,628 @@ int MAX_ITERATIONS = 100; // Adaptive maximum iterations
 const int NUM_THREADS = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 4;
 
 // Audio settings
-const int SAMPLE_RATE = 44100;
-const int AUDIO_CHANNELS = 1;
+const int AUDIO_CHANNELS = SYNTH_CHANNELS;
 const int AUDIO_BUFFER_SIZE = 2048;
 
-// Complex plane boundaries
-double xMin = -2.5;
-double xMax = 1.0;
-double yMin = -1.5;
-double yMax = 1.5;
+// Part of the complex plane on screen
+View view = View::around(-0.75, 0.0, 3.5, 3.0);
 
-// Previous rendering boundaries for optimization
-double prev_xMin = 0.0;
-double prev_xMax = 0.0;
-double prev_yMin = 0.0;
-double prev_yMax = 0.0;
+// View of the frame currently in the texture
+View prevView = View::around(0.0, 0.0, 0.0, 0.0);
+
+// Escape-time formula on screen, from the registry; F steps through them
+FormulaId formula = FORMULA_MANDELBROT;
+
+// Formula prompt: E opens it on the formula on screen, Enter compiles the text on
+// formulaThread, which posts formulaDoneEvent with the result in compiledFormula
+// and formulaError
+bool editingFormula = false;
+std::string formulaText;
+std::string formulaMessage;  // Under the text: the last error, or that it is compiling
+std::thread formulaThread;
+FormulaId compiledFormula = -1;
+std::string formulaError;
+Uint32 formulaDoneEvent = 0;
 
 // Precision control for dynamic detail
 std::atomic<bool> needsUpdate(true);
 std::atomic<bool> isHighQuality(false);
 std::atomic<bool> isRenderingHighQuality(false);
 
-// Calculate the number of iterations for a point in the complex plane
-inline int calculateMandelbrot(double real, double imag, int maxIter) {
-    double x = 0;
-    double y = 0;
-    double x2 = 0;
-    double y2 = 0;
-    
-    int iteration = 0;
-    // Using the optimized algorithm avoiding complex numbers and sqrt
-    while (x2 + y2 < 4.0 && iteration < maxIter) {
-        y = 2 * x * y + imag;
-        x = x2 - y2 + real;
-        x2 = x * x;
-        y2 = y * y;
-        iteration++;
+// Smooth iteration counts of the frame on screen, so clicks can skip recomputing them.
+// The frame covers prevView; frameMaxIterations is 0 when there is none.
+// A zoom-out preview's counts are approximate, so clicks never reuse them.
+std::vector<float> frameIterations(SCREEN_WIDTH * SCREEN_HEIGHT);
+int frameMaxIterations = 0;
+FormulaId frameFormula = FORMULA_MANDELBROT;
+bool frameIsPreview = false;
+
+// Recently played notes, so repeated or nearby clicks need no synthesis
+// Stored in the device format, which is only known once the device is open
+NoteCache noteCache(64, OutputFormat{ DEFAULT_SAMPLE_RATE, AUDIO_CHANNELS, SampleFormat::Float32 });
+
+AudioOutput audioOutput;
+
+// Iteration tiles of every region visited this session, so going back costs nothing
+TileCache tileCache(TILE_CACHE_BUDGET_BYTES);
+
+// Tiles kept on disk across sessions, when a store file is given
+TileStore tileStore;
+
+// Diagnostics overlay
+bool showAudioOverlay = false;
+const Uint32 OVERLAY_REFRESH_INTERVAL = 250; // ms
+
+// Frame timing: collected while the HUD is up or a frame log was asked for,
+// read by the render threads as each frame starts
+bool showFrameHud = false;
+std::atomic<bool> timeFrames(false);
+const size_t FRAME_LOG_CAPACITY = 512;
+FrameLog frameLog(FRAME_LOG_CAPACITY);
+
+// Event handling since the last frame was shown, charged to the next one
+double pendingEventsMs = 0.0;
+double pendingEventLagMs = 0.0;
+
+// Julia set inset: the Julia set of the last clicked or dragged-to point, in a
+// panel over the bottom-right corner. It shares the Mandelbrot kernels, with z
+// starting at each pixel and c fixed.
+bool showJulia = false;
+const int JULIA_INSET_WIDTH = 240;
+const int JULIA_INSET_HEIGHT = 180;
+const int JULIA_INSET_MARGIN = 8;
+const int JULIA_MAX_ITERATIONS = 1000;
+JuliaParameter juliaC = { DoubleDouble(-0.75), DoubleDouble(0.0) };
+const View JULIA_VIEW = View::around(0.0, 0.0, 3.2, 2.4);
+SDL_Texture* juliaTexture = nullptr;
+std::vector<Uint32> juliaPixels(JULIA_INSET_WIDTH * JULIA_INSET_HEIGHT);
+std::vector<float> juliaIterations(JULIA_INSET_WIDTH * JULIA_INSET_HEIGHT);
+
+// Trace file T writes when no --trace path was given
+const char* DEFAULT_TRACE_PATH = "mandelsound-trace.json";
+
+// Stop tracing and write out everything recorded since it started
+void finishTrace(const std::string& path) {
+    Tracer::instance().stop();
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Could not open " << path << std::endl;
+        return;
     }
-    
-    return iteration;
+    Tracer::instance().writeJson(file);
+    std::cout << "Trace written to " << path << std::endl;
 }
 
-// Map a value from one range to another
-inline double mapValue(double value, double inMin, double inMax, double outMin, double outMax) {
-    return outMin + (outMax - outMin) * ((value - inMin) / (inMax - inMin));
+// Draw the audio statistics in the top-left corner; returns the panel height
+int drawAudioOverlay(SDL_Renderer* renderer) {
+    AudioStats stats = audioOutput.stats();
+    const OutputFormat& format = audioOutput.format();
+    std::vector<std::string> lines;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+
+    line << "AUDIO " << format.sampleRate << " HZ " << format.channels << " CH BUF " << stats.bufferFrames;
+    lines.push_back(line.str()); line.str("");
+    line << "CALLBACK " << stats.lastCallbackMs << " MS (MAX " << stats.maxCallbackMs << ") / " << stats.budgetMs;
+    lines.push_back(line.str()); line.str("");
+    line << "CLICK LATENCY " << stats.lastLatencyMs << " + " << audioOutput.deviceLatencyMs() << " MS";
+    lines.push_back(line.str()); line.str("");
+    line << "PENDING " << stats.pendingBytes << " B  UNDERRUNS " << stats.underruns
+         << "  LATE " << stats.overBudgetCallbacks;
+    lines.push_back(line.str()); line.str("");
+    line << "NOTE CACHE " << noteCache.hits << " HIT " << noteCache.misses << " MISS";
+    lines.push_back(line.str()); line.str("");
+    line << "TILE CACHE " << tileCache.hits << " HIT " << tileCache.misses << " MISS "
+         << tileCache.bytes() / (1 << 20) << " MB";
+    lines.push_back(line.str()); line.str("");
+    if (tileStore.isOpen()) {
+        line << "TILE STORE " << tileStore.tileCount() << " TILES" << (tileStore.isWriter() ? "" : " READ ONLY");
+        lines.push_back(line.str());
+    }
+
+    return drawOverlayPanel(renderer, 8, 8, lines);
 }
 
-// Create a musical sound based on Mandelbrot properties
-std::vector<Sint16> createMandelbrotSound(int iterations, double real, double imag) {
-    // Base duration and primary frequency
-    double duration = 1.0;  // Reduced to 1 second for better responsiveness
-    double primaryFreq;
-    
-    if (iterations >= MAX_ITERATIONS) {
-        primaryFreq = 110.0;  // A2
-    } else {
-        primaryFreq = mapValue(iterations, 0, MAX_ITERATIONS, 220.0, 880.0);
+// Draw where the time of the last timed frame went, at the given height
+void drawFrameHud(SDL_Renderer* renderer, int top) {
+    std::vector<std::string> lines;
+    if (frameLog.empty()) {
+        lines.push_back("NO FRAME TIMED YET");
+        drawOverlayPanel(renderer, 8, top, lines);
+        return;
     }
-    
-    double secondaryFreq1 = primaryFreq * (1.0 + real * 0.1);
-    double secondaryFreq2 = primaryFreq * (1.0 + imag * 0.1);
-    double harmonicFreq = primaryFreq * 1.5;
-    
-    int sampleCount = static_cast<int>(SAMPLE_RATE * duration);
-    std::vector<Sint16> buffer(sampleCount);
-    
-    for (int i = 0; i < sampleCount; i++) {
-        double time = static_cast<double>(i) / SAMPLE_RATE;
-        double envelope;
-        double attackTime = 0.05;  // Shorter attack
-        double decayTime = 0.1;    // Shorter decay
-        double sustainLevel = 0.7;
-        double releaseTime = 0.3;  // Shorter release
-        
-        if (time < attackTime) {
-            envelope = time / attackTime;
-        } else if (time < attackTime + decayTime) {
-            envelope = 1.0 - (1.0 - sustainLevel) * ((time - attackTime) / decayTime);
-        } else if (time < duration - releaseTime) {
-            envelope = sustainLevel;
-        } else {
-            envelope = sustainLevel * (1.0 - (time - (duration - releaseTime)) / releaseTime);
-        }
-        
-        double sample = 0.5 * sin(2.0 * M_PI * primaryFreq * time);
-        sample += 0.25 * sin(2.0 * M_PI * secondaryFreq1 * time);
-        sample += 0.15 * sin(2.0 * M_PI * secondaryFreq2 * time);
-        sample += 0.1 * sin(2.0 * M_PI * harmonicFreq * time);
-        
-        sample *= envelope;
-        buffer[i] = static_cast<Sint16>(sample * 32767);
+    const FrameStats& stats = frameLog.latest();
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+
+    line << "FRAME " << stats.totalMs << " MS " << stats.kind << "  " << stats.mpixelsPerSecond() << " MPIX/S";
+    lines.push_back(line.str()); line.str("");
+    line << "TILES " << stats.stageMs[STAGE_TILES] << " COLOR " << stats.stageMs[STAGE_COLOR]
+         << " QUEUE " << stats.stageMs[STAGE_QUEUE];
+    lines.push_back(line.str()); line.str("");
+    line << "UPLOAD " << stats.stageMs[STAGE_UPLOAD] << " PRESENT " << stats.stageMs[STAGE_PRESENT]
+         << " EVENTS " << stats.eventsMs << " LAG " << stats.eventLagMs;
+    lines.push_back(line.str()); line.str("");
+    line << "TILES " << stats.tiles.tilesComputed << " COMPUTED " << stats.tiles.tilesFound << " FOUND  "
+         << stats.iterationsPerPixel() << " ITER/PX";
+    lines.push_back(line.str()); line.str("");
+    if (!stats.tiles.workers.empty()) {
+        // Busy share of the slowest and the fastest worker; far apart means poor balance
+        line << std::setprecision(0) << "WORKERS " << stats.tiles.workers.size() << " IN "
+             << stats.tiles.computeMs << " MS  LOAD " << stats.tiles.minLoad() * 100 << "-"
+             << stats.tiles.maxLoad() * 100 << "%";
+        lines.push_back(line.str());
     }
-    
-    return buffer;
+
+    drawOverlayPanel(renderer, 8, top, lines);
+}
+
+// Draw the formula prompt at the given height; returns the panel height
+int drawFormulaPrompt(SDL_Renderer* renderer, int top) {
+    std::vector<std::string> lines;
+    lines.push_back("FORMULA: " + formulaText + (formulaThread.joinable() ? "" : "_"));
+    lines.push_back(formulaMessage.empty() ? "ENTER COMPILES, ESC CANCELS" : formulaMessage);
+    return drawOverlayPanel(renderer, 8, top, lines);
+}
+
+// Where the last rendered view lies in the current one, in fractions of the screen
+struct FramePlacement {
+    double left;
+    double top;
+    double scale;
+};
+
+FramePlacement placeFrame() {
+    double scale = (prevView.width / view.width).toDouble();
+    return { view.widthsTo(prevView) - (scale - 1) / 2, view.heightsTo(prevView) - (scale - 1) / 2, scale };
+}
+
+// Whether the stretched frame still fills the screen, to within half a pixel
+bool frameCoversScreen() {
+    FramePlacement frame = placeFrame();
+    double slackX = 0.5 / SCREEN_WIDTH;
+    double slackY = 0.5 / SCREEN_HEIGHT;
+    return frame.left <= slackX && frame.top <= slackY &&
+           frame.left + frame.scale >= 1 - slackX && frame.top + frame.scale >= 1 - slackY;
+}
+
+// Show the current texture plus any overlays
+void presentFrame(SDL_Renderer* renderer, SDL_Texture* texture) {
+    TraceScope trace("frame", "present");
+    SDL_RenderClear(renderer);
+    if (frameMaxIterations > 0) {
+        // While zooming the texture still holds the last rendered view, so stretch
+        // it to where that view lies in the current one
+        FramePlacement frame = placeFrame();
+        SDL_FRect destination = {
+            static_cast<float>(frame.left * SCREEN_WIDTH), static_cast<float>(frame.top * SCREEN_HEIGHT),
+            static_cast<float>(frame.scale * SCREEN_WIDTH), static_cast<float>(frame.scale * SCREEN_HEIGHT)
+        };
+        TraceScope copyTrace("sdl", "SDL_RenderCopyF");
+        SDL_RenderCopyF(renderer, texture, NULL, &destination);
+    }
+    if (showJulia) {
+        SDL_Rect inset = {
+            SCREEN_WIDTH - JULIA_INSET_WIDTH - JULIA_INSET_MARGIN,
+            SCREEN_HEIGHT - JULIA_INSET_HEIGHT - JULIA_INSET_MARGIN,
+            JULIA_INSET_WIDTH, JULIA_INSET_HEIGHT
+        };
+        SDL_RenderCopy(renderer, juliaTexture, NULL, &inset);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderDrawRect(renderer, &inset);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    }
+    int overlayTop = 8;
+    if (showAudioOverlay) {
+        overlayTop += drawAudioOverlay(renderer) + 8;
+    }
+    if (editingFormula) {
+        overlayTop += drawFormulaPrompt(renderer, overlayTop) + 8;
+    }
+    if (showFrameHud) {
+        drawFrameHud(renderer, overlayTop);
+    }
+    TraceScope presentTrace("sdl", "SDL_RenderPresent");
+    SDL_RenderPresent(renderer);
 }
 
-// Thread function to render a portion of the Mandelbrot set
-void renderMandelbrotSection(Uint32* pixels, int startY, int endY, int width, int height, 
-                          double xMin, double xMax, double yMin, double yMax, int maxIterations) {
+// Thread function to colour a portion of a computed image
+void colorSection(Uint32* pixels, const float* iterationCounts, int startY, int endY, int width, int maxIterations) {
+    TraceScope trace("render", "color", endY - startY);
     for (int y = startY; y < endY; y++) {
         for (int x = 0; x < width; x++) {
-            double real = mapValue(x, 0, width, xMin, xMax);
-            double imag = mapValue(y, 0, height, yMin, yMax);
-            
-            int iterations = calculateMandelbrot(real, imag, maxIterations);
-            
-            Uint8 r, g, b;
-            if (iterations == maxIterations) {
-                // Inside the set - black
-                r = g = b = 0;
-            } else {
-                // Outside the set - color based on iterations
-                double hue = mapValue(iterations % 64, 0, 64, 0, 1);
-                double saturation = 0.8;
-                double value = iterations < maxIterations ? 1.0 : 0.0;
-                
-                // HSV to RGB conversion
-                double h = hue * 6.0;
-                int i = static_cast<int>(h);
-                double f = h - i;
-                double p = value * (1.0 - saturation);
-                double q = value * (1.0 - saturation * f);
-                double t = value * (1.0 - saturation * (1.0 - f));
-                
-                switch (i % 6) {
-                    case 0: r = value * 255; g = t * 255; b = p * 255; break;
-                    case 1: r = q * 255; g = value * 255; b = p * 255; break;
-                    case 2: r = p * 255; g = value * 255; b = t * 255; break;
-                    case 3: r = p * 255; g = q * 255; b = value * 255; break;
-                    case 4: r = t * 255; g = p * 255; b = value * 255; break;
-                    case 5: r = value * 255; g = p * 255; b = q * 255; break;
-                }
-            }
-            
-            pixels[y * width + x] = (r) | (g << 8) | (b << 16) | (255 << 24);
+            pixels[y * width + x] = colorForIterations(iterationCounts[y * width + x], maxIterations);
         }
     }
 }
 
-void renderMandelbrot(SDL_Renderer* renderer, SDL_Texture* texture, bool highQuality = true) {
-    Uint32* pixels = new Uint32[SCREEN_WIDTH * SCREEN_HEIGHT];
-    
-    // Skip rendering if boundaries haven't changed and high-quality is already done
-    if (highQuality && !needsUpdate && 
-        prev_xMin == xMin && prev_xMax == xMax && 
-        prev_yMin == yMin && prev_yMax == yMax) {
-        delete[] pixels;
-        return;
-    }
-    
-    // Store current boundaries
-    prev_xMin = xMin;
-    prev_xMax = xMax;
-    prev_yMin = yMin;
-    prev_yMax = yMax;
-    
-    // Calculate appropriate iterations based on zoom level
-    int localMaxIterations = highQuality ? MAX_ITERATIONS : MAX_ITERATIONS / 4;
-    
+// Colour a width x height image of smooth iteration counts on all cores
+void colorCounts(Uint32* pixels, const float* iterationCounts, int width, int height, int maxIterations) {
     // Use multithreading for better performance
     std::vector<std::thread> threads;
-    int sectionHeight = SCREEN_HEIGHT / NUM_THREADS;
+    int sectionHeight = height / NUM_THREADS;
     
     // Create the worker threads
     for (int i = 0; i < NUM_THREADS; i++) {
         int startY = i * sectionHeight;
-        int endY = (i == NUM_THREADS - 1) ? SCREEN_HEIGHT : startY + sectionHeight;
+        int endY = (i == NUM_THREADS - 1) ? height : startY + sectionHeight;
         
-        threads.push_back(std::thread(
-            renderMandelbrotSection, 
-            pixels, startY, endY, SCREEN_WIDTH, SCREEN_HEIGHT, 
-            xMin, xMax, yMin, yMax, localMaxIterations
-        ));
+        threads.push_back(std::thread(colorSection, pixels, iterationCounts, startY, endY, width, maxIterations));
     }
     
     // Wait for all threads to complete
     for (auto& thread : threads) {
         thread.join();
     }
+}
+
+// Render the Julia set of juliaC into the inset texture. The inset is small
+// enough to compute in full on every drag step, on all cores.
+void renderJulia() {
+    TraceScope trace("frame", "julia");
+    int maxIterations = std::min(MAX_ITERATIONS, JULIA_MAX_ITERATIONS);
+    KernelFrame frame(JULIA_VIEW, JULIA_INSET_WIDTH, JULIA_INSET_HEIGHT, maxIterations, IMAGE_KERNEL_FEATURES, juliaC,
+                      formula);
+    std::atomic<int> nextRow(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.push_back(std::thread([&]() {
+            std::vector<EscapeResult> results(JULIA_INSET_WIDTH);
+            for (int y = nextRow++; y < JULIA_INSET_HEIGHT; y = nextRow++) {
+                frame.renderRow(y, 0, JULIA_INSET_WIDTH, results.data());
+                for (int x = 0; x < JULIA_INSET_WIDTH; x++) {
+                    juliaIterations[y * JULIA_INSET_WIDTH + x] = results[x].smooth;
+                }
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    colorCounts(juliaPixels.data(), juliaIterations.data(), JULIA_INSET_WIDTH, JULIA_INSET_HEIGHT, maxIterations);
+    SDL_UpdateTexture(juliaTexture, NULL, juliaPixels.data(), JULIA_INSET_WIDTH * sizeof(Uint32));
+}
+
+// A computed frame, kept apart from the one on screen until it is shown
+struct FrameBuffer {
+    std::vector<Uint32> pixels;
+    std::vector<float> iterations;  // Smooth iteration counts
+    View view;
+    int maxIterations;
+    FormulaId formula;
+    bool preview;  // Approximate counts, for display only
+    const char* kind;  // Which pass computed it, for the frame log
+    bool timed;  // Whether stats were collected
+    FrameStats stats;
+    RenderClock::time_point readyTime;  // When it was ready to show
+};
+
+FrameBuffer lowQualityFrame;
+FrameBuffer highQualityFrame;  // Written by the background render
+FrameBuffer previewFrame;
+
+// Background high-quality render; its completion wakes the main loop with an event
+std::thread highQualityThread;
+std::atomic<bool> cancelHighQuality(false);
+Uint32 renderDoneEvent = 0;
+int renderGeneration = 0;
+
+// Point a frame at the current view
+void setFrameView(FrameBuffer& frame, int maxIterations) {
+    frame.pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT);
+    frame.iterations.resize(SCREEN_WIDTH * SCREEN_HEIGHT);
+    frame.view = view;
+    frame.maxIterations = maxIterations;
+    frame.formula = formula;
+    frame.preview = false;
+}
+
+// Colour a frame's iteration counts on all cores
+void colorFrame(FrameBuffer& frame) {
+    colorCounts(frame.pixels.data(), frame.iterations.data(), SCREEN_WIDTH, SCREEN_HEIGHT, frame.maxIterations);
+}
+
+// Start a frame's stats, or leave it untimed; returns where the stats go, or null
+FrameStats* startFrameStats(FrameBuffer& frame) {
+    frame.timed = timeFrames;
+    frame.stats = FrameStats();
+    frame.stats.kind = frame.kind;
+    frame.stats.pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    return frame.timed ? &frame.stats : nullptr;
+}
+
+// Compute a frame on all cores; workers give up early once cancel is set
+void computeFrame(FrameBuffer& frame, const std::atomic<bool>* cancel) {
+    TraceScope trace("frame", frame.kind, frame.maxIterations);
+    FrameStats* stats = startFrameStats(frame);
+    bool complete;
+    {
+        // Only tiles missing from the cache and the store are computed
+        ScopedTimer timer(stats != nullptr ? &stats->stageMs[STAGE_TILES] : nullptr);
+        complete = renderFromTiles(tileCache, tileStore.isOpen() ? &tileStore : nullptr, frame.view, SCREEN_WIDTH,
+                                   SCREEN_HEIGHT, frame.maxIterations, frame.formula, NUM_THREADS,
+                                   frame.iterations.data(), cancel, stats != nullptr ? &stats->tiles : nullptr);
+    }
+    if (complete) {
+        ScopedTimer timer(stats != nullptr ? &stats->stageMs[STAGE_COLOR] : nullptr);
+        colorFrame(frame);
+    }
+    frame.readyTime = RenderClock::now();
+}
+
+// Put a computed frame on screen and make it the frame clicks read from
+void showFrame(SDL_Renderer* renderer, SDL_Texture* texture, FrameBuffer& frame) {
+    TraceScope trace("frame", "show");
+    FrameStats* stats = frame.timed ? &frame.stats : nullptr;
+    if (stats != nullptr) {
+        stats->stageMs[STAGE_QUEUE] = millisecondsBetween(frame.readyTime, RenderClock::now());
+    }
+    {
+        // Update the texture with the rendered Mandelbrot set
+        ScopedTimer timer(stats != nullptr ? &stats->stageMs[STAGE_UPLOAD] : nullptr);
+        TraceScope uploadTrace("sdl", "SDL_UpdateTexture");
+        SDL_UpdateTexture(texture, NULL, frame.pixels.data(), SCREEN_WIDTH * sizeof(Uint32));
+    }
     
-    // Update the texture with the rendered Mandelbrot set
-    SDL_UpdateTexture(texture, NULL, pixels, SCREEN_WIDTH * sizeof(Uint32));
+    frameIterations.swap(frame.iterations);
+    frameMaxIterations = frame.maxIterations;
+    frameFormula = frame.formula;
+    frameIsPreview = frame.preview;
+    prevView = frame.view;
+    
+    // Log the frame before presenting it, so the HUD shows it; its present time
+    // is filled in afterwards and shows from the next redraw on
+    if (stats != nullptr) {
+        stats->eventsMs = pendingEventsMs;
+        stats->eventLagMs = pendingEventLagMs;
+        pendingEventsMs = pendingEventLagMs = 0.0;
+        stats->timeSeconds = SDL_GetTicks() / 1000.0;
+        frameLog.push(*stats);
+    }
     
     // Render the texture to the screen
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    RenderClock::time_point presentStart = RenderClock::now();
+    presentFrame(renderer, texture);
+    if (stats != nullptr) {
+        FrameStats& logged = frameLog.latest();
+        logged.stageMs[STAGE_PRESENT] = millisecondsBetween(presentStart, RenderClock::now());
+        logged.totalMs = millisecondsBetween(logged.tiles.start, RenderClock::now());
+    }
+}
+
+// Quick low-quality pass, rendered synchronously for responsiveness
+void renderMandelbrot(SDL_Renderer* renderer, SDL_Texture* texture) {
+    setFrameView(lowQualityFrame, MAX_ITERATIONS / 4);
+    lowQualityFrame.kind = "quick";
+    computeFrame(lowQualityFrame, nullptr);
+    showFrame(renderer, texture, lowQualityFrame);
+}
+
+// Zooming out uncovers a border the last frame never had: fill the screen from
+// the tiles earlier frames left at finer levels plus a coarse pass over the rest,
+// until the full-quality render of the settled view replaces it. Zoomed out
+// past the coarsest tiles there is nothing cheaper to fill the border with, so
+// the last frame is only stretched.
+void renderZoomOutPreview(SDL_Renderer* renderer, SDL_Texture* texture) {
+    setFrameView(previewFrame, MAX_ITERATIONS);
+    previewFrame.preview = true;
+    previewFrame.kind = "preview";
+    TraceScope trace("frame", previewFrame.kind, previewFrame.maxIterations);
+    FrameStats* stats = startFrameStats(previewFrame);
+    bool drawn;
+    {
+        ScopedTimer timer(stats != nullptr ? &stats->stageMs[STAGE_TILES] : nullptr);
+        drawn = renderPreview(tileCache, tileStore.isOpen() ? &tileStore : nullptr, previewFrame.view,
+                              SCREEN_WIDTH, SCREEN_HEIGHT, previewFrame.maxIterations, previewFrame.formula,
+                              NUM_THREADS, previewFrame.iterations.data(),
+                              stats != nullptr ? &stats->tiles : nullptr);
+    }
+    if (!drawn) {
+        presentFrame(renderer, texture);
+        return;
+    }
+    {
+        ScopedTimer timer(stats != nullptr ? &stats->stageMs[STAGE_COLOR] : nullptr);
+        colorFrame(previewFrame);
+    }
+    previewFrame.readyTime = RenderClock::now();
+    showFrame(renderer, texture, previewFrame);
+}
+
+// Stop a background render whose view is out of date
+void cancelHighQualityRender() {
+    if (highQualityThread.joinable()) {
+        cancelHighQuality = true;
+        highQualityThread.join();
+    }
+    isRenderingHighQuality = false;
+}
+
+// Start the full-quality pass in the background
+void startHighQualityRender() {
+    cancelHighQualityRender();
+    
+    // Skip rendering if the view hasn't changed and high-quality is already done
+    if (!needsUpdate && prevView == view) {
+        return;
+    }
     
-    delete[] pixels;
+    setFrameView(highQualityFrame, MAX_ITERATIONS);
+    highQualityFrame.kind = "full";
+    cancelHighQuality = false;
+    isRenderingHighQuality = true;
+    int generation = ++renderGeneration;
+    highQualityThread = std::thread([generation]() {
+        computeFrame(highQualityFrame, &cancelHighQuality);
+        
+        SDL_Event done;
+        SDL_memset(&done, 0, sizeof(done));
+        done.type = renderDoneEvent;
+        done.user.code = generation;
+        SDL_PushEvent(&done);
+    });
+}
+
+// Show the background render once its completion event arrives
+void finishHighQualityRender(SDL_Renderer* renderer, SDL_Texture* texture, int generation) {
+    // Events from cancelled renders arrive late and are ignored
+    if (generation != renderGeneration || !highQualityThread.joinable()) {
+        return;
+    }
+    highQualityThread.join();
+    showFrame(renderer, texture, highQualityFrame);
     
     // Mark as updated
-    if (highQuality) {
-        needsUpdate = false;
-        isHighQuality = true;
-        isRenderingHighQuality = false;
+    needsUpdate = false;
+    isHighQuality = true;
+    isRenderingHighQuality = false;
+}
+
+// Smooth zoom: wheel notches move a target view and the shown view glides toward
+// it, so a fast flick costs one render once the motion settles, not one per notch
+bool zoomAnimating = false;
+View targetView = view;
+Uint32 lastAnimationTime = 0;
+const double ZOOM_SMOOTHING = 60.0; // ms for the view to cover ~63% of the remaining distance
+const Uint32 ANIMATION_FRAME_INTERVAL = 16; // ms
+
+// Apply wheel notches to the target view, recentering on the point under the mouse
+void zoomTarget(int mouseX, int mouseY, int notches) {
+    if (!zoomAnimating) {
+        targetView = view;
+        zoomAnimating = true;
+        lastAnimationTime = SDL_GetTicks();
     }
+    
+    // Convert screen coordinates to the complex plane of the target view
+    targetView.centerReal = targetView.realAt(mouseX, SCREEN_WIDTH);
+    targetView.centerImag = targetView.imagAt(mouseY, SCREEN_HEIGHT);
+    
+    // Zoom factor - make it smoother
+    double zoomFactor = pow(0.8, notches);
+    targetView.width *= zoomFactor;
+    targetView.height *= zoomFactor;
+    
+    // Deeper views need more digits in the center
+    targetView.centerReal = targetView.centerReal.withLimbs(targetView.limbs());
+    targetView.centerImag = targetView.centerImag.withLimbs(targetView.limbs());
+}
+
+// Move the shown view toward the target; returns true once it has arrived
+bool stepZoomAnimation(Uint32 now) {
+    double k = 1.0 - exp(-static_cast<double>(now - lastAnimationTime) / ZOOM_SMOOTHING);
+    lastAnimationTime = now;
+    
+    // Size moves geometrically so every zoom step takes the same time
+    double scale = pow((targetView.width / view.width).toDouble(), k);
+    view.width *= scale;
+    view.height *= scale;
+    
+    // The remaining offset is small against the view, so it needs no more than a FloatExp
+    double offsetReal = view.widthsTo(targetView) * (1.0 - k);
+    double offsetImag = view.heightsTo(targetView) * (1.0 - k);
+    view.centerReal = targetView.centerReal - FixedPoint::fromFloatExp(view.width * offsetReal, targetView.limbs());
+    view.centerImag = targetView.centerImag - FixedPoint::fromFloatExp(view.height * offsetImag, targetView.limbs());
+    
+    bool arrived = fabs(log((view.width / targetView.width).toDouble())) < 1e-3 &&
+                   fabs(offsetReal) < 1e-3 &&
+                   fabs(offsetImag) < 1e-3;
+    if (arrived) {
+        view = targetView;
+    }
+    return arrived;
 }
 
 // Dynamic iteration adjustment based on zoom level
 void updateIterations() {
     // Calculate the zoom level
+    // Measured at the tile level the view is drawn from, so every view sharing
+    // a level asks for the same tiles
     double initialRange = 3.5; // Original width of view
-    double currentRange = xMax - xMin;
-    double zoomLevel = initialRange / currentRange;
+    FloatExp currentRange = tilePixelSpacing(tileLevelFor(view.width / SCREEN_WIDTH)) * SCREEN_WIDTH;
+    double zoomLevel = (FloatExp(initialRange) / currentRange).toDouble();
     
     // Adjust iterations based on zoom level, with a minimum and maximum
-    MAX_ITERATIONS = static_cast<int>(100 * sqrt(zoomLevel));
+    // (deep zooms overflow zoomLevel, so clamp before converting)
+    MAX_ITERATIONS = static_cast<int>(std::min(100 * sqrt(zoomLevel), 2000.0));
     if (MAX_ITERATIONS < 100) MAX_ITERATIONS = 100;
-    if (MAX_ITERATIONS > 2000) MAX_ITERATIONS = 2000;
 }
 
 int main(int argc, char* args[]) {
+    // Optional periodic dump of the audio statistics, one JSON object per line
+    const char* audioStatsPath = nullptr;
+    Uint32 audioStatsInterval = 1000; // ms
+    // Optional dump of the last frames' timing at exit, one JSON object per line
+    const char* frameLogPath = nullptr;
+    // Where T and exit write the trace; --trace also starts tracing at launch
+    std::string tracePath = DEFAULT_TRACE_PATH;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(args[i], "--audio-stats") && i + 1 < argc) {
+            audioStatsPath = args[++i];
+        } else if (!strcmp(args[i], "--audio-stats-interval") && i + 1 < argc) {
+            audioStatsInterval = static_cast<Uint32>(std::max(1, atoi(args[++i])));
+        } else if (!strcmp(args[i], "--trace") && i + 1 < argc) {
+            tracePath = args[++i];
+            Tracer::instance().start();
+            traceThreadName("main");
+        } else if (!strcmp(args[i], "--frame-log") && i + 1 < argc) {
+            frameLogPath = args[++i];
+        } else if (!strcmp(args[i], "--formula") && i + 1 < argc) {
+            std::string error;
+            formula = findOrCompileFormula(args[++i], error);
+            if (formula < 0) {
+                std::cerr << "Formula " << args[i] << ": " << error << "; the built-in ones are";
+                for (FormulaId id = 0; id < FormulaRegistry::instance().size(); id++) {
+                    std::cerr << " " << FormulaRegistry::instance().get(id).name;
+                }
+                std::cerr << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(args[i], "--tile-store") && i + 1 < argc) {
+            const char* tileStorePath = args[++i];
+            if (!tileStore.open(tileStorePath)) {
+                std::cerr << "Could not open tile store " << tileStorePath << std::endl;
+                return 1;
+            }
+            if (!tileStore.isWriter()) {
+                std::cerr << "Another process is writing " << tileStorePath << "; reading it only" << std::endl;
+            }
+        } else {
+            std::cerr << "Usage: 2man [--audio-stats <file|->] [--audio-stats-interval ms] [--frame-log <file|->]"
+                         " [--trace file] [--tile-store file] [--formula name|text]" << std::endl;
+            return 1;
+        }
+    }
+    std::ofstream audioStatsFile;
+    std::ostream* audioStatsOut = nullptr;
+    if (audioStatsPath != nullptr) {
+        if (!strcmp(audioStatsPath, "-")) {
+            audioStatsOut = &std::cout;
+        } else {
+            audioStatsFile.open(audioStatsPath);
+            if (!audioStatsFile) {
+                std::cerr << "Could not open " << audioStatsPath << std::endl;
+                return 1;
+            }
+            audioStatsOut = &audioStatsFile;
+        }
+    }
+    std::ofstream frameLogFile;
+    std::ostream* frameLogOut = nullptr;
+    if (frameLogPath != nullptr) {
+        if (!strcmp(frameLogPath, "-")) {
+            frameLogOut = &std::cout;
+        } else {
+            frameLogFile.open(frameLogPath);
+            if (!frameLogFile) {
+                std::cerr << "Could not open " << frameLogPath << std::endl;
+                return 1;
+            }
+            frameLogOut = &frameLogFile;
+        }
+        timeFrames = true;
+    }
+    
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
@@ -252,16 +677,7 @@ int main(int argc, char* args[]) {
     }
     
     // Set up audio
-    SDL_AudioSpec want, have;
-    SDL_memset(&want, 0, sizeof(want));
-    want.freq = SAMPLE_RATE;
-    want.format = AUDIO_S16SYS;
-    want.channels = AUDIO_CHANNELS;
-    want.samples = AUDIO_BUFFER_SIZE;
-    want.callback = NULL;
-    
-    SDL_AudioDeviceID audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
-    if (audioDevice == 0) {
+    if (!audioOutput.open(AUDIO_BUFFER_SIZE)) {
         std::cerr << "Failed to open audio: " << SDL_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
@@ -269,94 +685,311 @@ int main(int argc, char* args[]) {
         return 1;
     }
     
-    // Create a texture for the Mandelbrot set
+    const OutputFormat& outputFormat = audioOutput.format();
+    noteCache.setOutputFormat(outputFormat);
+    std::cout << "Audio: " << outputFormat.sampleRate << " Hz, " << outputFormat.channels << " channels, "
+              << (outputFormat.format == SampleFormat::Float32 ? "float32" : 
+                  outputFormat.format == SampleFormat::Int16 ? "int16" : "int32") << std::endl;
+    
+    // Create a texture for the Mandelbrot set, filtered since zoom animation stretches it
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
     SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, 
                                           SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    juliaTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                     JULIA_INSET_WIDTH, JULIA_INSET_HEIGHT);
+    
+    // Render, audio and formula completion are posted as events, so the loop can sleep until then
+    renderDoneEvent = SDL_RegisterEvents(3);
+    Uint32 audioDoneEvent = renderDoneEvent + 1;
+    formulaDoneEvent = renderDoneEvent + 2;
+    
+    // Text input events only while the formula prompt is open, so shortcut keys type nothing
+    SDL_StopTextInput();
+    audioOutput.setCompletionEvent(audioDoneEvent);
     
     // Render the initial Mandelbrot set (low quality first for responsiveness)
-    renderMandelbrot(renderer, texture, false);
+    renderMandelbrot(renderer, texture);
     
     // Main loop
     bool quit = false;
     SDL_Event e;
     Uint32 lastRenderTime = 0;
     const Uint32 RENDER_DELAY = 50; // 50ms between low and high quality renders
+    Uint32 lastOverlayTime = 0;
+    Uint32 lastAudioStatsTime = SDL_GetTicks();
     
     while (!quit) {
-        // Handle events
-        while (SDL_PollEvent(&e) != 0) {
+        // Sleep until an event arrives or the next timed job is due, so an idle
+        // window costs no CPU; -1 waits indefinitely
+        Uint32 now = SDL_GetTicks();
+        int timeout = -1;
+        auto waitUntil = [&](Uint32 due) {
+            int wait = due > now ? static_cast<int>(due - now) : 0;
+            timeout = timeout < 0 ? wait : std::min(timeout, wait);
+        };
+        if (zoomAnimating) {
+            waitUntil(lastAnimationTime + ANIMATION_FRAME_INTERVAL);
+        }
+        else if (needsUpdate && !isHighQuality && !isRenderingHighQuality) {
+            waitUntil(lastRenderTime + RENDER_DELAY + 1);
+        }
+        if (showAudioOverlay && audioOutput.isPlaying()) {
+            waitUntil(lastOverlayTime + OVERLAY_REFRESH_INTERVAL);
+        }
+        if (audioStatsOut != nullptr) {
+            waitUntil(lastAudioStatsTime + audioStatsInterval);
+        }
+        bool hasEvent;
+        {
+            TraceScope waitTrace("sdl", "SDL_WaitEvent");
+            hasEvent = timeout < 0 ? SDL_WaitEvent(&e) != 0 : SDL_WaitEventTimeout(&e, timeout) != 0;
+        }
+        
+        // A drag moves the Julia parameter many times per batch of events; render the inset once after them
+        bool juliaMoved = false;
+        
+        // Show another formula; the tiles of each are cached apart, so coming back is instant
+        auto switchFormula = [&](FormulaId next) {
+            formula = next;
+            const FormulaEntry& entry = FormulaRegistry::instance().get(formula);
+            std::cout << "Formula: " << entry.name << ", " << entry.expression << std::endl;
+            cancelHighQualityRender();
+            renderMandelbrot(renderer, texture);
+            lastRenderTime = SDL_GetTicks();
+            needsUpdate = true;
+            isHighQuality = false;
+            juliaMoved = showJulia;
+        };
+        
+        // Handle the event that woke us and everything else already queued
+        for (; hasEvent; hasEvent = SDL_PollEvent(&e) != 0) {
+            // Showing a finished render is timed as part of its frame
+            bool timeEvent = timeFrames && e.type != renderDoneEvent;
+            ScopedTimer eventTimer(timeEvent ? &pendingEventsMs : nullptr);
+            TraceScope eventTrace("ui", "event", e.type);
+            if (timeEvent) {
+                double lag = static_cast<double>(SDL_GetTicks() - e.common.timestamp);
+                pendingEventLagMs = std::max(pendingEventLagMs, lag);
+            }
             if (e.type == SDL_QUIT) {
                 quit = true;
             }
+            else if (e.type == renderDoneEvent) {
+                finishHighQualityRender(renderer, texture, e.user.code);
+            }
+            else if (e.type == formulaDoneEvent) {
+                formulaThread.join();
+                if (compiledFormula < 0) {
+                    // The panel has room for the first line; the rest, such as compiler output, goes to the console
+                    std::cerr << "Formula " << formulaText << ": " << formulaError << std::endl;
+                    formulaMessage = formulaError.substr(0, formulaError.find('\n'));
+                    presentFrame(renderer, texture);
+                } else if (editingFormula) {
+                    editingFormula = false;
+                    SDL_StopTextInput();
+                    switchFormula(compiledFormula);
+                }
+            }
+            else if (e.type == SDL_TEXTINPUT) {
+                if (editingFormula && !formulaThread.joinable()) {
+                    formulaText += e.text.text;
+                    presentFrame(renderer, texture);
+                }
+            }
+            else if (e.type == audioDoneEvent) {
+                if (showAudioOverlay) {
+                    presentFrame(renderer, texture);
+                }
+            }
+            else if (e.type == SDL_WINDOWEVENT) {
+                if (e.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    presentFrame(renderer, texture);
+                }
+            }
             else if (e.type == SDL_MOUSEBUTTONDOWN) {
                 if (e.button.button == SDL_BUTTON_LEFT) {
+                    // Latency is measured from when SDL saw the click, so event backlog counts too
+                    Uint64 clickCounter = SDL_GetPerformanceCounter() - 
+                        (SDL_GetTicks() - e.button.timestamp) * SDL_GetPerformanceFrequency() / 1000;
                     int mouseX = e.button.x;
                     int mouseY = e.button.y;
                     
-                    double real = mapValue(mouseX, 0, SCREEN_WIDTH, xMin, xMax);
-                    double imag = mapValue(mouseY, 0, SCREEN_HEIGHT, yMin, yMax);
+                    FixedPoint pointReal = view.realAt(mouseX, SCREEN_WIDTH);
+                    FixedPoint pointImag = view.imagAt(mouseY, SCREEN_HEIGHT);
+                    double real = pointReal.toDouble();
+                    double imag = pointImag.toDouble();
                     
-                    // Calculate iterations at clicked point
-                    int iterations = calculateMandelbrot(real, imag, MAX_ITERATIONS);
+                    // Reuse the iteration count from the frame on screen when it is exact: a pixel
+                    // that escaped below the frame's cap escapes identically at any higher cap.
+                    // It is the count of the tile pixel nearest the click, which is what the screen shows
+                    double iterations;
+                    float frameIteration = frameIterations[mouseY * SCREEN_WIDTH + mouseX];
+                    if (frameMaxIterations > 0 && 
+                        !frameIsPreview &&
+                        prevView == view &&
+                        frameFormula == formula &&
+                        (frameIteration < frameMaxIterations || frameMaxIterations == MAX_ITERATIONS)) {
+                        iterations = frameIteration;
+                    } else {
+                        // Same kernel the frame would use, so the note matches the colour
+                        EscapeResult result;
+                        KernelFrame(view, SCREEN_WIDTH, SCREEN_HEIGHT, MAX_ITERATIONS, IMAGE_KERNEL_FEATURES, formula)
+                            .renderRow(mouseY, mouseX, 1, &result);
+                        iterations = result.smooth;
+                    }
+                    
+                    // The inset follows the clicked point
+                    juliaC = { pointReal.toDoubleDouble(), pointImag.toDoubleDouble() };
+                    juliaMoved = showJulia;
                     
                     // Create and play sound
-                    std::vector<Sint16> soundBuffer = createMandelbrotSound(iterations, real, imag);
-                    SDL_ClearQueuedAudio(audioDevice);
-                    SDL_QueueAudio(audioDevice, soundBuffer.data(), soundBuffer.size() * sizeof(Sint16));
-                    SDL_PauseAudioDevice(audioDevice, 0);
+                    NoteCache::Buffer soundBuffer = noteCache.get(iterations, real, imag, MAX_ITERATIONS);
+                    audioOutput.play(soundBuffer, clickCounter);
                     
-                    std::cout << "Clicked at (" << real << ", " << imag << ") with " 
+                    // Print every digit that tells this pixel apart from its neighbours
+                    int digits = std::max(6, static_cast<int>(-(view.width / SCREEN_WIDTH).log2() * 0.30103) + 3);
+                    std::cout << "Clicked at (" << pointReal.toString(digits) << ", " << pointImag.toString(digits) << ") with " 
                               << iterations << " iterations." << std::endl;
                 }
             }
+            else if (e.type == SDL_MOUSEMOTION) {
+                // Dragging with the left button held sweeps the Julia parameter, without sound
+                if (showJulia && (e.motion.state & SDL_BUTTON_LMASK) != 0) {
+                    juliaC = { view.realAt(e.motion.x, SCREEN_WIDTH).toDoubleDouble(),
+                               view.imagAt(e.motion.y, SCREEN_HEIGHT).toDoubleDouble() };
+                    juliaMoved = true;
+                }
+            }
+            else if (e.type == SDL_KEYDOWN) {
+                if (editingFormula) {
+                    // The prompt takes the keyboard; the text itself arrives as SDL_TEXTINPUT
+                    SDL_Keycode key = e.key.keysym.sym;
+                    if (key == SDLK_ESCAPE) {
+                        editingFormula = false;
+                        SDL_StopTextInput();
+                    } else if (formulaThread.joinable()) {
+                        // Compiling; the text stays as sent
+                    } else if (key == SDLK_BACKSPACE && !formulaText.empty()) {
+                        formulaText.pop_back();
+                    } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+                        formulaMessage = "COMPILING...";
+                        std::string text = formulaText;
+                        formulaThread = std::thread([text]() {
+                            compiledFormula = findOrCompileFormula(text, formulaError);
+                            SDL_Event done;
+                            SDL_memset(&done, 0, sizeof(done));
+                            done.type = formulaDoneEvent;
+                            SDL_PushEvent(&done);
+                        });
+                    }
+                    presentFrame(renderer, texture);
+                }
+                else if (e.key.keysym.sym == SDLK_e) {
+                    editingFormula = true;
+                    formulaText = FormulaRegistry::instance().get(formula).expression;
+                    formulaMessage.clear();
+                    SDL_StartTextInput();
+                    presentFrame(renderer, texture);
+                }
+                else if (e.key.keysym.sym == SDLK_a) {
+                    showAudioOverlay = !showAudioOverlay;
+                    presentFrame(renderer, texture);
+                }
+                else if (e.key.keysym.sym == SDLK_t) {
+                    // First press starts a trace, the second writes it out
+                    if (Tracer::instance().enabled()) {
+                        finishTrace(tracePath);
+                    } else {
+                        Tracer::instance().start();
+                        traceThreadName("main");
+                        std::cout << "Tracing; press T again to write " << tracePath << std::endl;
+                    }
+                }
+                else if (e.key.keysym.sym == SDLK_f) {
+                    switchFormula((formula + 1) % FormulaRegistry::instance().size());
+                }
+                else if (e.key.keysym.sym == SDLK_j) {
+                    showJulia = !showJulia;
+                    juliaMoved = showJulia;
+                    if (!showJulia) {
+                        presentFrame(renderer, texture);
+                    }
+                }
+                else if (e.key.keysym.sym == SDLK_h) {
+                    showFrameHud = !showFrameHud;
+                    timeFrames = showFrameHud || frameLogOut != nullptr;
+                    presentFrame(renderer, texture);
+                }
+            }
             else if (e.type == SDL_MOUSEWHEEL) {
-                int mouseX, mouseY;
-                SDL_GetMouseState(&mouseX, &mouseY);
-                
-                // Convert screen coordinates to complex plane
-                double centerReal = mapValue(mouseX, 0, SCREEN_WIDTH, xMin, xMax);
-                double centerImag = mapValue(mouseY, 0, SCREEN_HEIGHT, yMin, yMax);
-                
-                // Zoom factor - make it smoother
-                double zoomFactor = (e.wheel.y > 0) ? 0.8 : 1.25;
-                
-                // Calculate new boundaries
-                double newWidth = (xMax - xMin) * zoomFactor;
-                double newHeight = (yMax - yMin) * zoomFactor;
-                
-                xMin = centerReal - newWidth / 2;
-                xMax = centerReal + newWidth / 2;
-                yMin = centerImag - newHeight / 2;
-                yMax = centerImag + newHeight / 2;
-                
-                // Update iterations based on zoom level
-                updateIterations();
-                
-                // Mark for re-rendering
-                needsUpdate = true;
-                isHighQuality = false;
-                
-                // Render at low quality immediately for responsiveness
-                renderMandelbrot(renderer, texture, false);
-                lastRenderTime = SDL_GetTicks();
+                if (e.wheel.y != 0) {
+                    int mouseX, mouseY;
+                    SDL_GetMouseState(&mouseX, &mouseY);
+                    
+                    // Only the target moves here; the animation below redraws at display rate
+                    zoomTarget(mouseX, mouseY, e.wheel.y);
+                    
+                    // Mark for re-rendering, abandoning any full-quality pass of the old view
+                    cancelHighQualityRender();
+                    needsUpdate = true;
+                    isHighQuality = false;
+                }
             }
         }
         
-        // Two-phase rendering strategy: quick render first, then high quality
+        if (juliaMoved) {
+            renderJulia();
+            presentFrame(renderer, texture);
+        }
+        
+        // Animate the zoom by stretching the last frame; render for real only once it settles
         Uint32 currentTime = SDL_GetTicks();
-        if (needsUpdate && !isHighQuality && !isRenderingHighQuality && 
+        if (zoomAnimating && currentTime - lastAnimationTime >= ANIMATION_FRAME_INTERVAL) {
+            if (stepZoomAnimation(currentTime)) {
+                zoomAnimating = false;
+                lastRenderTime = currentTime;
+            }
+            // Update iterations based on zoom level
+            updateIterations();
+            if (frameCoversScreen()) {
+                presentFrame(renderer, texture);
+            } else {
+                renderZoomOutPreview(renderer, texture);
+            }
+        }
+        
+        // Two-phase rendering strategy: quick render first, then high quality
+        if (needsUpdate && !isHighQuality && !isRenderingHighQuality && !zoomAnimating && 
             (currentTime - lastRenderTime > RENDER_DELAY)) {
-            isRenderingHighQuality = true;
-            renderMandelbrot(renderer, texture, true);
+            startHighQualityRender();
         }
         
-        // Small delay to prevent hogging the CPU
-        SDL_Delay(1);
+        // Keep the diagnostics current
+        if (showAudioOverlay && audioOutput.isPlaying() && 
+            currentTime - lastOverlayTime >= OVERLAY_REFRESH_INTERVAL) {
+            presentFrame(renderer, texture);
+            lastOverlayTime = currentTime;
+        }
+        if (audioStatsOut != nullptr && currentTime - lastAudioStatsTime >= audioStatsInterval) {
+            writeAudioStatsJson(*audioStatsOut, audioOutput.stats(), audioOutput.deviceLatencyMs(), currentTime / 1000.0);
+            lastAudioStatsTime = currentTime;
+        }
     }
     
     // Clean up
+    cancelHighQualityRender();
+    if (formulaThread.joinable()) {
+        formulaThread.join();
+    }
+    if (Tracer::instance().enabled()) {
+        finishTrace(tracePath);
+    }
+    if (frameLogOut != nullptr) {
+        frameLog.forEach([&](const FrameStats& stats) { writeFrameStatsJson(*frameLogOut, stats); });
+    }
     SDL_DestroyTexture(texture);
-    SDL_CloseAudioDevice(audioDevice);
+    SDL_DestroyTexture(juliaTexture);
+    audioOutput.close();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include "sound.h"
+#include "trace.h"
+
+// What the audio callback has measured so far
+struct AudioStats {
+    int bufferFrames = 0;          // Frames the device asks for per callback
+    double budgetMs = 0.0;         // How long one device buffer lasts
+    Uint64 callbacks = 0;
+    double lastCallbackMs = 0.0;   // Time spent inside the callback
+    double meanCallbackMs = 0.0;
+    double maxCallbackMs = 0.0;
+    Uint64 overBudgetCallbacks = 0;
+    Uint64 underruns = 0;          // Callbacks that arrived too late to keep the device fed
+    Uint64 notes = 0;
+    double lastLatencyMs = 0.0;    // Click until its first sample was handed to the device
+    double maxLatencyMs = 0.0;
+    Uint32 pendingBytes = 0;       // Note data not yet handed to the device
+    Uint32 maxPendingBytes = 0;
+};
+
+// Audio device fed from a callback that plays one note at a time.
+// The callback is the output stage: notes arrive already in the device format
+// and are copied straight into the device buffer, timing everything it does.
+class AudioOutput {
+public:
+    // Open the default device, preferring its native rate, format and layout
+    bool open(int bufferFrames) {
+        SDL_AudioSpec want;
+        SDL_memset(&want, 0, sizeof(want));
+        want.freq = DEFAULT_SAMPLE_RATE;
+        want.format = AUDIO_F32SYS;
+        want.channels = SYNTH_CHANNELS;
+        want.samples = static_cast<Uint16>(bufferFrames);
+        want.callback = &AudioOutput::callback;
+        want.userdata = this;
+
+        // Take the device's native rate, format and layout, so the synth produces
+        // exactly what it consumes and neither SDL nor the sound server converts
+        device = SDL_OpenAudioDevice(NULL, 0, &want, &spec,
+            SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_FORMAT_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+        if (device != 0 && !outputFormatFromSpec(spec, outputFormat)) {
+            // A format the output stage cannot write: let SDL convert from float stereo instead
+            SDL_CloseAudioDevice(device);
+            device = SDL_OpenAudioDevice(NULL, 0, &want, &spec, 0);
+            outputFormatFromSpec(spec, outputFormat);
+        }
+        if (device == 0) {
+            return false;
+        }
+
+        counterFrequency = static_cast<double>(SDL_GetPerformanceFrequency());
+        current = AudioStats();
+        current.bufferFrames = spec.samples;
+        current.budgetMs = 1000.0 * spec.samples / spec.freq;
+        // The callback's lane is taken here, since taking one on SDL's audio thread
+        // could wait on the tracer's lock for a whole dump
+        traceLane = Tracer::instance().acquire();
+        traceLane->name = "audio callback";
+        SDL_PauseAudioDevice(device, 0);
+        return true;
+    }
+
+    void close() {
+        if (device != 0) {
+            SDL_CloseAudioDevice(device);
+            device = 0;
+        }
+        if (traceLane != nullptr) {
+            Tracer::instance().release(traceLane);
+            traceLane = nullptr;
+        }
+    }
+
+    const OutputFormat& format() const { return outputFormat; }
+
+    // Post an event of this type whenever a note finishes playing (0 for none)
+    void setCompletionEvent(Uint32 eventType) { completionEvent = eventType; }
+
+    bool isPlaying() {
+        SDL_LockAudioDevice(device);
+        bool playing = voice && voicePosition < voice->size();
+        SDL_UnlockAudioDevice(device);
+        return playing;
+    }
+
+    // Replace whatever is playing; requestCounter is when the user asked for it
+    void play(NoteCache::Buffer note, Uint64 requestCounter) {
+        SDL_LockAudioDevice(device);
+        voice = note;
+        voicePosition = 0;
+        voiceRequested = requestCounter;
+        voiceStarted = false;
+        current.notes++;
+        SDL_UnlockAudioDevice(device);
+    }
+
+    AudioStats stats() {
+        SDL_LockAudioDevice(device);
+        AudioStats snapshot = current;
+        SDL_UnlockAudioDevice(device);
+        return snapshot;
+    }
+
+    // Time a sample spends in the device buffer after the callback writes it
+    double deviceLatencyMs() const { return current.budgetMs; }
+
+private:
+    static bool outputFormatFromSpec(const SDL_AudioSpec& spec, OutputFormat& format) {
+        format.sampleRate = spec.freq;
+        format.channels = spec.channels;
+        switch (spec.format) {
+            case AUDIO_F32SYS: format.format = SampleFormat::Float32; return true;
+            case AUDIO_S16SYS: format.format = SampleFormat::Int16; return true;
+            case AUDIO_S32SYS: format.format = SampleFormat::Int32; return true;
+            default: return false;
+        }
+    }
+
+    static void SDLCALL callback(void* userdata, Uint8* stream, int len) {
+        static_cast<AudioOutput*>(userdata)->fill(stream, len);
+    }
+
+    // Runs on SDL's audio thread with the device lock held
+    void fill(Uint8* stream, int len) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        TraceScope trace(traceLane, "audio", "callback", len);
+
+        // A callback that comes well over one buffer after the previous one means
+        // the device ran dry in between
+        bool wasPlaying = voice && voicePosition < voice->size();
+        if (lastCallbackCounter != 0 && wasPlaying &&
+            toMs(start - lastCallbackCounter) > 1.5 * current.budgetMs) {
+            current.underruns++;
+        }
+        lastCallbackCounter = start;
+
+        size_t copied = 0;
+        if (voice && voicePosition < voice->size()) {
+            copied = std::min(static_cast<size_t>(len), voice->size() - voicePosition);
+            memcpy(stream, voice->data() + voicePosition, copied);
+            voicePosition += copied;
+            if (voicePosition == voice->size() && completionEvent != 0) {
+                SDL_Event done;
+                SDL_memset(&done, 0, sizeof(done));
+                done.type = completionEvent;
+                SDL_PushEvent(&done);
+            }
+            if (!voiceStarted) {
+                voiceStarted = true;
+                current.lastLatencyMs = toMs(start - voiceRequested);
+                current.maxLatencyMs = std::max(current.maxLatencyMs, current.lastLatencyMs);
+            }
+        }
+        memset(stream + copied, spec.silence, len - copied);
+
+        current.pendingBytes = voice ? static_cast<Uint32>(voice->size() - voicePosition) : 0;
+        current.maxPendingBytes = std::max(current.maxPendingBytes, current.pendingBytes);
+
+        double elapsed = toMs(SDL_GetPerformanceCounter() - start);
+        current.callbacks++;
+        current.lastCallbackMs = elapsed;
+        current.maxCallbackMs = std::max(current.maxCallbackMs, elapsed);
+        current.meanCallbackMs += (elapsed - current.meanCallbackMs) / static_cast<double>(current.callbacks);
+        if (elapsed > current.budgetMs) {
+            current.overBudgetCallbacks++;
+        }
+    }
+
+    double toMs(Uint64 counterDelta) const {
+        return 1000.0 * static_cast<double>(counterDelta) / counterFrequency;
+    }
+
+    SDL_AudioDeviceID device = 0;
+    SDL_AudioSpec spec;
+    OutputFormat outputFormat = { DEFAULT_SAMPLE_RATE, SYNTH_CHANNELS, SampleFormat::Float32 };
+    double counterFrequency = 1.0;
+    Uint32 completionEvent = 0;
+    TraceBuffer* traceLane = nullptr;  // Recorded into by the callback alone
+
+    // Guarded by the device lock
+    NoteCache::Buffer voice;
+    size_t voicePosition = 0;
+    Uint64 voiceRequested = 0;
+    bool voiceStarted = false;
+    Uint64 lastCallbackCounter = 0;
+    AudioStats current;
+};
+
+// One JSON object per line, so dumps can be tailed and parsed incrementally
+inline void writeAudioStatsJson(std::ostream& out, const AudioStats& stats, double deviceLatencyMs, double timeSeconds) {
+    out << "{\"time_s\":" << timeSeconds
+        << ",\"buffer_frames\":" << stats.bufferFrames
+        << ",\"budget_ms\":" << stats.budgetMs
+        << ",\"callbacks\":" << stats.callbacks
+        << ",\"callback_ms_last\":" << stats.lastCallbackMs
+        << ",\"callback_ms_mean\":" << stats.meanCallbackMs
+        << ",\"callback_ms_max\":" << stats.maxCallbackMs
+        << ",\"over_budget\":" << stats.overBudgetCallbacks
+        << ",\"underruns\":" << stats.underruns
+        << ",\"notes\":" << stats.notes
+        << ",\"latency_ms_last\":" << stats.lastLatencyMs
+        << ",\"latency_ms_max\":" << stats.maxLatencyMs
+        << ",\"device_latency_ms\":" << deviceLatencyMs
+        << ",\"pending_bytes\":" << stats.pendingBytes
+        << ",\"pending_bytes_max\":" << stats.maxPendingBytes
+        << "}" << std::endl;
+}
@@ -0,0 +1,362 @@
+// Headless benchmarks of the render and synthesis hot paths
+//
+//   mandelbench [--size WxH] [--repeats n] [--threads 1,2,4] [--iterations 256,2048]
+//               [--views default,seahorse,...] [--formula name|text] [--notes n] [--out file|-]
+//
+// Every kernel runs over a fixed set of views at each iteration cap and thread
+// count, and the fastest of --repeats runs is reported, as one JSON document:
+//
+//   point     calculateMandelbrot on every pixel, as man.cpp and the click path use it
+//   frame     a KernelFrame at the precision the view needs, row by row, as a tile is drawn
+//   tiles     renderFromTiles into an empty cache, the whole cost of a new frame in 2man
+//   synth     createMandelbrotSound for --notes notes, one per click
+//
+// frame and tiles iterate --formula (default mandelbrot): a built-in formula's
+// name or any formula formula_jit.h compiles, such as "z^2 + c" to set it against
+// the built-in kernel.
+//
+// Rates are in screen pixels, escape iterations (the cap for points inside the
+// set, even where the periodicity test stopped early) and stereo sample frames.
+// speedup is against the same benchmark on one thread.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "formula_jit.h"
+#include "mandelbrot.h"
+#include "sound.h"
+#include "tile_cache.h"
+#include "tile_render.h"
+#include "view.h"
+
+const int HARDWARE_THREADS = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 4;
+
+struct BenchView {
+    const char* name;
+    const char* real;  // Decimal, so deep views keep every digit
+    const char* imag;
+    double width;      // Height follows the image's aspect ratio
+};
+
+// From the whole set down to perturbation depths: exterior bands, the boundary,
+// a view that is mostly interior, and the two precisions past double
+const BenchView BENCH_VIEWS[] = {
+    { "default", "-0.75", "0", 3.5 },
+    { "seahorse", "-0.7453", "0.1127", 0.01 },
+    { "minibrot", "-1.7548776662466927", "0", 0.02 },
+    { "deep", "-0.743643887037151", "0.131825904205330", 1e-11 },
+    { "perturbation", "0", "1", 1e-60 },
+};
+
+struct BenchOptions {
+    int width = 400;
+    int height = 300;
+    int repeats = 3;
+    std::vector<int> threads;
+    std::vector<int> iterations = { 256, 2048 };
+    std::vector<std::string> views;
+    FormulaId formula = FORMULA_MANDELBROT;
+    int notes = 32;
+};
+
+struct BenchResult {
+    std::string kernel;
+    std::string view;
+    std::string precision;
+    int maxIterations;
+    int threads;
+    double seconds;
+    double pixels;
+    double iterations;
+    double samples;
+};
+
+static View viewFor(const BenchView& bench, int width, int height) {
+    View view;
+    view.width = FloatExp(bench.width);
+    view.height = view.width * (static_cast<double>(height) / width);
+    view.centerReal = FixedPoint::fromDecimal(bench.real, view.limbs());
+    view.centerImag = FixedPoint::fromDecimal(bench.imag, view.limbs());
+    return view;
+}
+
+// Fastest of `repeats` runs of body, in seconds
+static double timeBest(int repeats, const std::function<void()>& body) {
+    double best = 0.0;
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = r == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// Run rowBody(y) for every row, rows shared out between threads
+static void forEachRow(int height, int threadCount, const std::function<void(int)>& rowBody) {
+    std::atomic<int> nextRow(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int y = nextRow++; y < height; y = nextRow++) {
+                rowBody(y);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+static void runViewBenchmarks(const BenchView& bench, const BenchOptions& options,
+                              std::vector<BenchResult>& results) {
+    const int width = options.width;
+    const int height = options.height;
+    const double pixels = static_cast<double>(width) * height;
+    View view = viewFor(bench, width, height);
+    std::vector<EscapeResult> image(static_cast<size_t>(width) * height);
+    std::vector<float> counts(image.size());
+
+    for (int maxIterations : options.iterations) {
+        KernelPrecision precision =
+            formulaPrecision(choosePrecision((view.width / width).toDouble(), maxIterations), options.formula);
+        for (int threadCount : options.threads) {
+            // The point kernel is plain double, so it only has the views doubles can resolve
+            if (precision == KernelPrecision::Float || precision == KernelPrecision::Double) {
+                double left = view.realAt(0, width).toDouble();
+                double top = view.imagAt(0, height).toDouble();
+                double step = (view.width / width).toDouble();
+                std::vector<long long> rowIterations(height);
+                double seconds = timeBest(options.repeats, [&]() {
+                    forEachRow(height, threadCount, [&](int y) {
+                        long long sum = 0;
+                        for (int x = 0; x < width; x++) {
+                            sum += calculateMandelbrot(left + x * step, top + y * step, maxIterations);
+                        }
+                        rowIterations[y] = sum;
+                    });
+                });
+                double iterations = 0;
+                for (long long sum : rowIterations) {
+                    iterations += sum;
+                }
+                results.push_back({ "point", bench.name, "double", maxIterations, threadCount, seconds, pixels,
+                                    iterations, 0 });
+            }
+
+            // A frame is built per render, so choosing its reference orbit counts too
+            double seconds = timeBest(options.repeats, [&]() {
+                KernelFrame frame(view, width, height, maxIterations, IMAGE_KERNEL_FEATURES, options.formula);
+                forEachRow(height, threadCount, [&](int y) {
+                    frame.renderRow(y, 0, width, image.data() + static_cast<size_t>(y) * width);
+                });
+            });
+            double iterations = 0;
+            for (const EscapeResult& result : image) {
+                iterations += result.iterations;
+            }
+            results.push_back({ "frame", bench.name, precisionName(precision), maxIterations, threadCount, seconds,
+                                pixels, iterations, 0 });
+
+            seconds = timeBest(options.repeats, [&]() {
+                TileCache cache(TILE_CACHE_BUDGET_BYTES);
+                renderFromTiles(cache, nullptr, view, width, height, maxIterations, options.formula, threadCount,
+                                counts.data(), nullptr);
+            });
+            KernelPrecision tilePrecision = formulaPrecision(
+                choosePrecision(tilePixelSpacing(tileLevelFor(view.width / width)).toDouble(), maxIterations),
+                options.formula);
+            results.push_back({ "tiles", bench.name, precisionName(tilePrecision), maxIterations, threadCount,
+                                seconds, pixels, iterations, 0 });
+        }
+    }
+}
+
+// Notes for points spread over the default view, as a run of clicks would give
+static void benchSynth(const BenchOptions& options, std::vector<BenchResult>& results) {
+    const int maxIterations = 100;
+    std::vector<double> noteIterations(options.notes), noteReal(options.notes), noteImag(options.notes);
+    for (int i = 0; i < options.notes; i++) {
+        noteReal[i] = -2.0 + 2.5 * (i % 8) / 8.0;
+        noteImag[i] = -1.25 + 2.5 * (i / 8 % 8) / 8.0;
+        noteIterations[i] = calculateMandelbrotDetailed(noteReal[i], noteImag[i], maxIterations, false).smooth;
+    }
+    for (int threadCount : options.threads) {
+        std::vector<double> noteSamples(options.notes);
+        double seconds = timeBest(options.repeats, [&]() {
+            forEachRow(options.notes, threadCount, [&](int i) {
+                noteSamples[i] = static_cast<double>(createMandelbrotSound(noteIterations[i], noteReal[i],
+                                                                           noteImag[i], maxIterations,
+                                                                           DEFAULT_SAMPLE_RATE).size() /
+                                                     SYNTH_CHANNELS);
+            });
+        });
+        double samples = 0;
+        for (double count : noteSamples) {
+            samples += count;
+        }
+        results.push_back({ "synth", "", "", maxIterations, threadCount, seconds, 0, 0, samples });
+    }
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static void writeJson(std::ostream& out, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    out << "{\n";
+    out << "  \"compiler\": " << jsonString(__VERSION__) << ",\n";
+    out << "  \"hardware_threads\": " << HARDWARE_THREADS << ",\n";
+    out << "  \"kernel_vector_bytes\": " << KERNEL_VECTOR_BYTES << ",\n";
+    out << "  \"width\": " << options.width << ",\n";
+    out << "  \"height\": " << options.height << ",\n";
+    out << "  \"repeats\": " << options.repeats << ",\n";
+    out << "  \"formula\": " << jsonString(FormulaRegistry::instance().get(options.formula).name) << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        // The single-threaded run of the same benchmark, for the speedup
+        double baseline = result.seconds;
+        for (const BenchResult& other : results) {
+            if (other.threads == 1 && other.kernel == result.kernel && other.view == result.view &&
+                other.maxIterations == result.maxIterations) {
+                baseline = other.seconds;
+            }
+        }
+        std::ostringstream line;
+        line.precision(6);
+        line << "    {\"kernel\": " << jsonString(result.kernel);
+        if (!result.view.empty()) {
+            line << ", \"view\": " << jsonString(result.view) << ", \"precision\": " << jsonString(result.precision);
+        }
+        line << ", \"max_iterations\": " << result.maxIterations << ", \"threads\": " << result.threads
+             << ", \"seconds\": " << result.seconds;
+        if (result.pixels > 0) {
+            line << ", \"mpixels_per_second\": " << result.pixels / result.seconds / 1e6
+                 << ", \"iterations_per_second\": " << result.iterations / result.seconds;
+        }
+        if (result.samples > 0) {
+            line << ", \"samples_per_second\": " << result.samples / result.seconds;
+        }
+        line << ", \"speedup\": " << baseline / result.seconds << "}";
+        out << (i == 0 ? "\n" : ",\n") << line.str();
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Comma-separated positive integers
+static bool parseList(const char* text, std::vector<int>& values) {
+    values.clear();
+    std::istringstream fields(text);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        int value = atoi(field.c_str());
+        if (value <= 0) {
+            return false;
+        }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+int main(int argc, char* args[]) {
+    BenchOptions options;
+    // One thread, then doubling up to every hardware thread
+    for (int threads = 1; threads < HARDWARE_THREADS; threads *= 2) {
+        options.threads.push_back(threads);
+    }
+    options.threads.push_back(HARDWARE_THREADS);
+    const char* outputPath = "-";
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+        if (!strcmp(args[i], "--size") && hasValue) {
+            ok = sscanf(args[++i], "%dx%d", &options.width, &options.height) == 2 && options.width > 0 &&
+                 options.height > 0;
+        } else if (!strcmp(args[i], "--repeats") && hasValue) {
+            options.repeats = atoi(args[++i]);
+            ok = options.repeats > 0;
+        } else if (!strcmp(args[i], "--threads") && hasValue) {
+            ok = parseList(args[++i], options.threads);
+        } else if (!strcmp(args[i], "--iterations") && hasValue) {
+            ok = parseList(args[++i], options.iterations);
+        } else if (!strcmp(args[i], "--views") && hasValue) {
+            std::istringstream fields(args[++i]);
+            std::string field;
+            while (std::getline(fields, field, ',')) {
+                options.views.push_back(field);
+            }
+        } else if (!strcmp(args[i], "--formula") && hasValue) {
+            std::string error;
+            options.formula = findOrCompileFormula(args[++i], error);
+            if (options.formula < 0) {
+                std::cerr << "Formula " << args[i] << ": " << error << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(args[i], "--notes") && hasValue) {
+            options.notes = atoi(args[++i]);
+            ok = options.notes >= 0;
+        } else if (!strcmp(args[i], "--out") && hasValue) {
+            outputPath = args[++i];
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Usage: mandelbench [--size WxH] [--repeats n] [--threads 1,2,4] [--iterations 256,2048]"
+                         " [--views default,seahorse,minibrot,deep,perturbation] [--formula name|text] [--notes n]"
+                         " [--out file|-]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    for (const std::string& name : options.views) {
+        if (std::none_of(std::begin(BENCH_VIEWS), std::end(BENCH_VIEWS),
+                         [&](const BenchView& view) { return name == view.name; })) {
+            std::cerr << "Unknown view: " << name << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (const BenchView& view : BENCH_VIEWS) {
+        if (options.views.empty() ||
+            std::find(options.views.begin(), options.views.end(), view.name) != options.views.end()) {
+            std::cerr << "Benchmarking " << view.name << std::endl;
+            runViewBenchmarks(view, options, results);
+        }
+    }
+    if (options.notes > 0) {
+        std::cerr << "Benchmarking synth" << std::endl;
+        benchSynth(options, results);
+    }
+
+    if (!strcmp(outputPath, "-")) {
+        writeJson(std::cout, options, results);
+    } else {
+        std::ofstream file(outputPath);
+        if (!file) {
+            std::cerr << "Could not open " << outputPath << std::endl;
+            return 1;
+        }
+        writeJson(file, options, results);
+    }
+    return 0;
+}
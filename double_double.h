@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#if defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+// Double-double arithmetic: a value held as the unevaluated sum hi + lo of two
+// doubles, giving about 106 bits of mantissa (32 decimal digits) at a few times
+// the cost of a double. T is double, or a GCC/Clang vector of doubles, so the
+// same code runs one value or a whole SIMD register of them.
+//
+// The error-free transforms below depend on every operation being rounded
+// exactly as written; do not build this with -ffast-math, and build it with
+// -ffp-contract=off, as CMakeLists.txt and the formula compiler do, since Clang
+// and GCC on FMA targets such as aarch64 otherwise fuse the splits.
+
+// a * b - c with a single rounding, for exact products on FMA hardware
+inline double fusedMultiplySubtract(double a, double b, double c) {
+    return std::fma(a, b, -c);
+}
+
+#if defined(__FMA__)
+typedef double FmaDouble2 __attribute__((vector_size(16)));
+inline FmaDouble2 fusedMultiplySubtract(const FmaDouble2& a, const FmaDouble2& b, const FmaDouble2& c) {
+    return reinterpret_cast<FmaDouble2>(_mm_fmsub_pd(reinterpret_cast<__m128d>(a), reinterpret_cast<__m128d>(b),
+                                                     reinterpret_cast<__m128d>(c)));
+}
+
+typedef double FmaDouble4 __attribute__((vector_size(32)));
+inline FmaDouble4 fusedMultiplySubtract(const FmaDouble4& a, const FmaDouble4& b, const FmaDouble4& c) {
+    return reinterpret_cast<FmaDouble4>(_mm256_fmsub_pd(reinterpret_cast<__m256d>(a), reinterpret_cast<__m256d>(b),
+                                                        reinterpret_cast<__m256d>(c)));
+}
+#endif
+
+// s + err == a + b exactly. Inputs are taken by value so outputs may alias them.
+template <typename T>
+inline void twoSum(T a, T b, T& s, T& err) {
+    s = a + b;
+    T bb = s - a;
+    err = (a - (s - bb)) + (b - bb);
+}
+
+// Same, for |a| >= |b|
+template <typename T>
+inline void quickTwoSum(T a, T b, T& s, T& err) {
+    s = a + b;
+    err = b - (s - a);
+}
+
+// p + err == a * b exactly
+template <typename T>
+inline void twoProduct(T a, T b, T& p, T& err) {
+    p = a * b;
+#if defined(__FMA__)
+    // Compilers contract a * b - c into an FMA here, which would break Dekker's
+    // split below; use the FMA deliberately instead
+    err = fusedMultiplySubtract(a, b, p);
+#else
+    // Dekker: split each factor into 26-bit halves whose products are exact. Only
+    // with contraction off: a fused aHi * bHi - p would not round as written
+    const T splitter = T{} + 134217729.0;  // 2^27 + 1
+    T ta = splitter * a;
+    T aHi = ta - (ta - a);
+    T aLo = a - aHi;
+    T tb = splitter * b;
+    T bHi = tb - (tb - b);
+    T bLo = b - bHi;
+    err = ((aHi * bHi - p) + aHi * bLo + aLo * bHi) + aLo * bLo;
+#endif
+}
+
+template <typename T>
+struct DoubleDoubleT {
+    T hi;
+    T lo;
+
+    DoubleDoubleT() = default;
+    DoubleDoubleT(const T& value) : hi(value), lo(T{}) {}
+    DoubleDoubleT(const T& hi, const T& lo) : hi(hi), lo(lo) {}
+
+    // Multiplying by two is exact, so it needs no renormalization
+    DoubleDoubleT twice() const { return DoubleDoubleT(hi + hi, lo + lo); }
+};
+
+typedef DoubleDoubleT<double> DoubleDouble;
+
+template <typename T>
+inline DoubleDoubleT<T> operator+(const DoubleDoubleT<T>& a, const DoubleDoubleT<T>& b) {
+    T s, e, t, f;
+    twoSum(a.hi, b.hi, s, e);
+    twoSum(a.lo, b.lo, t, f);
+    e += t;
+    quickTwoSum(s, e, s, e);
+    e += f;
+    quickTwoSum(s, e, s, e);
+    return DoubleDoubleT<T>(s, e);
+}
+
+template <typename T>
+inline DoubleDoubleT<T> operator-(const DoubleDoubleT<T>& a) {
+    return DoubleDoubleT<T>(-a.hi, -a.lo);
+}
+
+template <typename T>
+inline DoubleDoubleT<T> operator-(const DoubleDoubleT<T>& a, const DoubleDoubleT<T>& b) {
+    return a + (-b);
+}
+
+template <typename T>
+inline DoubleDoubleT<T> operator*(const DoubleDoubleT<T>& a, const DoubleDoubleT<T>& b) {
+    T p, e;
+    twoProduct(a.hi, b.hi, p, e);
+    e += a.hi * b.lo + a.lo * b.hi;
+    quickTwoSum(p, e, p, e);
+    return DoubleDoubleT<T>(p, e);
+}
+
+// Long division: a quotient from the high parts, then one correction from the remainder
+template <typename T>
+inline DoubleDoubleT<T> operator/(const DoubleDoubleT<T>& a, const DoubleDoubleT<T>& b) {
+    T q = a.hi / b.hi;
+    DoubleDoubleT<T> remainder = a - b * DoubleDoubleT<T>(q);
+    T correction = remainder.hi / b.hi;
+    quickTwoSum(q, correction, q, correction);
+    return DoubleDoubleT<T>(q, correction);
+}
+
+inline DoubleDouble operator+(const DoubleDouble& a, double b) { return a + DoubleDouble(b); }
+inline DoubleDouble operator-(const DoubleDouble& a, double b) { return a - DoubleDouble(b); }
+inline DoubleDouble operator*(const DoubleDouble& a, double b) { return a * DoubleDouble(b); }
+
+// The low part never changes which side of a bound a value is on by more than
+// an ulp of the high part, which is all the escape test needs
+template <typename T>
+inline auto operator<(const DoubleDoubleT<T>& a, const DoubleDoubleT<T>& b) -> decltype(a.hi < b.hi) {
+    return a.hi < b.hi;
+}
+
+inline bool operator==(const DoubleDouble& a, const DoubleDouble& b) {
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+inline bool operator!=(const DoubleDouble& a, const DoubleDouble& b) {
+    return !(a == b);
+}
+
+inline double toDouble(const DoubleDouble& value) {
+    return value.hi + value.lo;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "double_double.h"
+#include "fixed_point.h"
+#include "mandelbrot.h"
+#include "palette.h"
+#include "perturbation.h"
+#include "trace.h"
+
+// Exponential-map rendering of zooms into one point.
+//
+// Every frame of a zoom into a fixed center sees the same plane, only at
+// another scale, so the plane is rendered once in log-polar coordinates: a strip
+// whose columns are angles around the center and whose rows are radii, each row
+// a constant factor inside the one before. The factor matches the angular step,
+// so samples are square at every depth. A frame is then a resampling of the
+// rows its radii span. The strip costs about columns^2 / 2 pi samples per
+// e-fold of zoom whatever the frame rate, which is a few frames' worth, so it
+// pays off for smooth videos with many frames per e-fold.
+//
+// Deep samples are computed by perturbation from one reference orbit at the
+// center, shallow ones by the kernels at the precision their spacing needs. All
+// are stored coloured, so frames blend colours rather than iteration counts
+// that wrap around the palette. Rows are rendered as frames first need them and
+// dropped once no frame in sight does, so memory stays at about the span of a
+// few frames.
+
+// Columns for each pixel of a frame's half-diagonal, around the circle; above
+// 1 the strip is finer than the frame everywhere, so bilinear sampling stays sharp
+const double EXP_MAP_OVERSAMPLING = 1.5;
+
+class ExpMap {
+public:
+    // Rows run from outerRadius down to innerRadius; iterationsAt gives the
+    // iteration cap for the samples at a radius
+    ExpMap(const FixedPoint& centerReal, const FixedPoint& centerImag, const FloatExp& outerRadius,
+           const FloatExp& innerRadius, int columns, const std::function<int(const FloatExp&)>& iterationsAt)
+        : columns(columns), outerBits(outerRadius.log2()), rowBits(2 * M_PI / columns / std::log(2.0)) {
+        int rows = std::max(2, static_cast<int>(std::ceil((outerBits - innerRadius.log2()) / rowBits)) + 1);
+        caps.resize(rows);
+        int maxIterations = 1;
+        for (int row = 0; row < rows; row++) {
+            caps[row] = iterationsAt(radius(row));
+            maxIterations = std::max(maxIterations, caps[row]);
+        }
+        strip.resize(rows);
+        orbit = computeReferenceOrbit(centerReal, centerImag, maxIterations);
+        this->centerReal = centerReal.toDoubleDouble();
+        this->centerImag = centerImag.toDoubleDouble();
+    }
+
+    int rowCount() const { return static_cast<int>(strip.size()); }
+    int columnCount() const { return columns; }
+
+    FloatExp radius(int row) const {
+        double bits = outerBits - row * rowBits;
+        double whole = std::floor(bits);
+        return FloatExp(std::exp2(bits - whole), static_cast<long long>(whole));
+    }
+
+    // Rows a width x height frame at this pixel spacing samples, from its corners to its center
+    int firstRow(const FloatExp& spacing, int width, int height) const {
+        double cornerBits = spacing.log2() + std::log2(std::hypot(width / 2.0, height / 2.0));
+        return std::max(0, std::min(rowCount() - 1, static_cast<int>(std::floor((outerBits - cornerBits) / rowBits))));
+    }
+
+    int lastRow(const FloatExp& spacing) const {
+        double nearestBits = spacing.log2();  // The pixels beside the center, one spacing out
+        return std::max(0, std::min(rowCount() - 1, static_cast<int>(std::ceil((outerBits - nearestBits) / rowBits))));
+    }
+
+    // Have rows [first, last] rendered and drop every other one
+    void keepRows(int first, int last, int threadCount) {
+        for (int row = 0; row < rowCount(); row++) {
+            if ((row < first || row > last) && !strip[row].empty()) {
+                std::vector<uint32_t>().swap(strip[row]);
+            }
+        }
+        std::vector<int> missing;
+        for (int row = first; row <= last; row++) {
+            if (strip[row].empty()) {
+                missing.push_back(row);
+            }
+        }
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([&]() {
+                for (size_t i = next++; i < missing.size(); i = next++) {
+                    renderRow(missing[i]);
+                }
+            }));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Where each pixel of a width x height frame falls in the strip, relative to
+    // its center: the rows above the center's row and the column. Only the
+    // center's row changes from frame to frame.
+    void setFrameSize(int width, int height) {
+        pixelRows.resize(static_cast<size_t>(width) * height);
+        pixelColumns.resize(pixelRows.size());
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                // The kernels place pixel (x, y) at x - width / 2 spacings from the center
+                double dx = x - width / 2.0;
+                double dy = y - height / 2.0;
+                double distance = std::max(1.0, std::hypot(dx, dy));
+                double angle = std::atan2(dy, dx);
+                if (angle < 0.0) {
+                    angle += 2 * M_PI;
+                }
+                size_t i = static_cast<size_t>(y) * width + x;
+                pixelRows[i] = std::log2(distance) / rowBits;
+                pixelColumns[i] = std::min(angle / (2 * M_PI) * columns,
+                                           std::nextafter(static_cast<double>(columns), 0.0));
+            }
+        }
+    }
+
+    // A frame of the size last set, centered on the map's center at this pixel
+    // spacing, as packed RGB from rows keepRows has rendered
+    void renderFrame(const FloatExp& spacing, uint8_t* rgb) const {
+        double centerRow = (outerBits - spacing.log2()) / rowBits;
+        double maxRow = rowCount() - 1;
+        for (size_t i = 0; i < pixelRows.size(); i++) {
+            double row = std::max(0.0, std::min(maxRow, centerRow - pixelRows[i]));
+            int row0 = std::min(static_cast<int>(row), rowCount() - 2);
+            int row1 = row0 + 1;
+            float rowWeight = static_cast<float>(row - row0);
+
+            double column = pixelColumns[i];
+            int column0 = static_cast<int>(column);
+            int column1 = column0 + 1 == columns ? 0 : column0 + 1;
+            float columnWeight = static_cast<float>(column - column0);
+
+            const uint32_t* near = strip[row0].data();
+            const uint32_t* far = strip[row1].data();
+            for (int channel = 0; channel < 3; channel++) {
+                int shift = 8 * channel;
+                float top = mix(byteOf(near[column0], shift), byteOf(near[column1], shift), columnWeight);
+                float bottom = mix(byteOf(far[column0], shift), byteOf(far[column1], shift), columnWeight);
+                *rgb++ = static_cast<uint8_t>(mix(top, bottom, rowWeight) + 0.5f);
+            }
+        }
+    }
+
+private:
+    static float byteOf(uint32_t color, int shift) { return static_cast<float>((color >> shift) & 0xFF); }
+    static float mix(float a, float b, float weight) { return a + (b - a) * weight; }
+
+    // Rows wide enough for the kernels' own precisions take them, since
+    // perturbation finishes the smooth count with the reference's c, which is
+    // only close enough to the sample's once the offsets are tiny
+    void renderRow(int row) {
+        TraceScope trace("render", "exp map row", row);
+        FloatExp r = radius(row);
+        KernelPrecision precision = choosePrecision((r * (2 * M_PI / columns)).toDouble(), caps[row]);
+        std::vector<EscapeResult> results(columns);
+        if (precision == KernelPrecision::Perturbation) {
+            for (int column = 0; column < columns; column++) {
+                double angle = 2 * M_PI * column / columns;
+                results[column] = perturbationPoint(orbit, r.mantissa * std::cos(angle), r.mantissa * std::sin(angle),
+                                                    r.exponent, caps[row]);
+            }
+        } else {
+            std::vector<DoubleDouble> real(columns), imag(columns);
+            double offset = r.toDouble();
+            for (int column = 0; column < columns; column++) {
+                double angle = 2 * M_PI * column / columns;
+                real[column] = centerReal + offset * std::cos(angle);
+                imag[column] = centerImag + offset * std::sin(angle);
+            }
+            selectPointKernel(precision)(real.data(), imag.data(), columns, caps[row], results.data());
+        }
+
+        std::vector<uint32_t> colors(columns);
+        for (int column = 0; column < columns; column++) {
+            colors[column] = colorForIterations(results[column].smooth, caps[row]);
+        }
+        strip[row].swap(colors);
+    }
+
+    int columns;
+    double outerBits;  // log2 of the outermost row's radius
+    double rowBits;    // Each row's radius is 2^-rowBits of the one before
+    std::vector<int> caps;  // Iteration cap per row
+    std::vector<std::vector<uint32_t>> strip;  // Coloured rows; empty until rendered
+    ReferenceOrbit orbit;
+    DoubleDouble centerReal;  // For the rows the row kernels render
+    DoubleDouble centerImag;
+    std::vector<double> pixelRows;
+    std::vector<double> pixelColumns;
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "double_double.h"
+
+// Arbitrary-precision numbers for deep zooms.
+//
+// FloatExp is a double mantissa with a separate 64-bit exponent: plenty of
+// relative precision for sizes and offsets, with a range far beyond the
+// 1e-308 where doubles stop. FixedPoint is a sign and a magnitude in 32-bit
+// limbs with a fixed binary point, for positions that need every digit.
+
+struct FloatExp {
+    double mantissa;     // 0, or magnitude in [0.5, 1)
+    long long exponent;  // value = mantissa * 2^exponent
+
+    FloatExp() : mantissa(0.0), exponent(0) {}
+    FloatExp(double value) : FloatExp(value, 0) {}
+    FloatExp(double m, long long e) {
+        int shift = 0;
+        mantissa = std::frexp(m, &shift);
+        exponent = mantissa == 0.0 ? 0 : e + shift;
+    }
+
+    // Zero once the value is below the smallest double, infinite above the largest
+    double toDouble() const {
+        if (mantissa == 0.0) {
+            return 0.0;
+        }
+        return std::ldexp(mantissa, static_cast<int>(std::max(-4000LL, std::min(4000LL, exponent))));
+    }
+
+    double log2() const { return std::log2(std::fabs(mantissa)) + static_cast<double>(exponent); }
+
+    FloatExp operator-() const { return FloatExp(-mantissa, exponent); }
+    FloatExp operator*(const FloatExp& other) const { return FloatExp(mantissa * other.mantissa, exponent + other.exponent); }
+    FloatExp operator/(const FloatExp& other) const { return FloatExp(mantissa / other.mantissa, exponent - other.exponent); }
+    FloatExp operator*(double factor) const { return *this * FloatExp(factor); }
+    FloatExp operator/(double divisor) const { return *this / FloatExp(divisor); }
+    FloatExp& operator*=(double factor) { return *this = *this * factor; }
+
+    bool operator==(const FloatExp& other) const { return mantissa == other.mantissa && exponent == other.exponent; }
+    bool operator!=(const FloatExp& other) const { return !(*this == other); }
+};
+
+class FixedPoint {
+public:
+    // The most significant limb is the integer part; the rest are the fraction
+    static constexpr int MIN_LIMBS = 3;
+
+    FixedPoint() : FixedPoint(MIN_LIMBS) {}
+    explicit FixedPoint(int limbCount) : negative(false), limbs(std::max(limbCount, MIN_LIMBS), 0u) {}
+
+    static FixedPoint fromFloatExp(const FloatExp& value, int limbCount) {
+        FixedPoint result(limbCount);
+        if (value.mantissa == 0.0) {
+            return result;
+        }
+        result.negative = value.mantissa < 0.0;
+        // 53 significant bits, placed with their lowest bit at `shift` in limb units
+        uint64_t bits = static_cast<uint64_t>(std::ldexp(std::fabs(value.mantissa), 53));
+        long long shift = value.exponent - 53 + 32LL * (result.size() - 1);
+        if (shift < 0) {
+            if (shift <= -64) {
+                return result;
+            }
+            bits >>= -shift;
+            shift = 0;
+        }
+        for (int i = 0; i < 3 && bits != 0; i++) {
+            long long bit = shift + 32LL * i;
+            int limb = static_cast<int>(bit / 32);
+            int offset = static_cast<int>(bit % 32);
+            uint64_t part = (bits & 0xFFFFFFFFull) << offset;
+            bits >>= 32;
+            for (int j = limb; part != 0 && j < result.size(); j++) {
+                uint64_t sum = static_cast<uint64_t>(result.limbs[j]) + (part & 0xFFFFFFFFull);
+                result.limbs[j] = static_cast<uint32_t>(sum);
+                part = (part >> 32) + (sum >> 32);
+            }
+        }
+        return result;
+    }
+
+    static FixedPoint fromDouble(double value, int limbCount) {
+        return fromFloatExp(FloatExp(value), limbCount);
+    }
+
+    // A decimal such as "-1.7497591451303665" with every digit kept, which a
+    // double would round off long before the deep zooms that need it
+    static FixedPoint fromDecimal(const std::string& text, int limbCount) {
+        bool negative = !text.empty() && text[0] == '-';
+        size_t first = negative ? 1 : 0;
+        size_t point = std::min(text.find('.'), text.size());
+        FixedPoint result = fromDouble(std::atof(text.substr(first, point - first).c_str()), limbCount);
+
+        // 1/10 by long division, limb by limb below the integer one
+        std::vector<uint32_t> tenthLimbs(std::max(limbCount, MIN_LIMBS), 0u);
+        uint64_t remainder = 1;
+        for (int i = static_cast<int>(tenthLimbs.size()) - 2; i >= 0; i--) {
+            tenthLimbs[i] = static_cast<uint32_t>((remainder << 32) / 10);
+            remainder = (remainder << 32) % 10;
+        }
+        FixedPoint tenth = fromLimbs(false, tenthLimbs);
+        FixedPoint weight = fromDouble(1.0, limbCount);
+        for (size_t i = point + 1; i < text.size(); i++) {
+            weight = weight * tenth;
+            result = result + weight * fromDouble(text[i] - '0', limbCount);
+        }
+        return negative ? -result : result;
+    }
+
+    // Raw sign and limbs, least significant first, as limbValues() returns them
+    static FixedPoint fromLimbs(bool negative, const std::vector<uint32_t>& limbs) {
+        FixedPoint result(static_cast<int>(limbs.size()));
+        result.negative = negative;
+        std::copy(limbs.begin(), limbs.end(), result.limbs.begin());
+        return result;
+    }
+
+    bool isNegative() const { return negative && !isZero(); }
+    const std::vector<uint32_t>& limbValues() const { return limbs; }
+
+    int size() const { return static_cast<int>(limbs.size()); }
+
+    // Same value with more or fewer fraction limbs
+    FixedPoint withLimbs(int limbCount) const {
+        limbCount = std::max(limbCount, MIN_LIMBS);
+        FixedPoint result(limbCount);
+        result.negative = negative;
+        int offset = limbCount - size();
+        for (int i = 0; i < size(); i++) {
+            if (i + offset >= 0) {
+                result.limbs[i + offset] = limbs[i];
+            }
+        }
+        return result;
+    }
+
+    FloatExp toFloatExp() const {
+        int top = size() - 1;
+        while (top >= 0 && limbs[top] == 0) {
+            top--;
+        }
+        if (top < 0) {
+            return FloatExp();
+        }
+        double mantissa = limbs[top];
+        if (top >= 1) {
+            mantissa += std::ldexp(static_cast<double>(limbs[top - 1]), -32);
+        }
+        if (top >= 2) {
+            mantissa += std::ldexp(static_cast<double>(limbs[top - 2]), -64);
+        }
+        return FloatExp(negative ? -mantissa : mantissa, 32LL * (top - (size() - 1)));
+    }
+
+    double toDouble() const { return toFloatExp().toDouble(); }
+
+    DoubleDouble toDoubleDouble() const {
+        double hi = toDouble();
+        double lo = (*this - fromDouble(hi, size())).toDouble();
+        return DoubleDouble(hi, lo);
+    }
+
+    // Decimal digits after the point, truncated
+    std::string toString(int digits) const {
+        std::string text = negative && !isZero() ? "-" : "";
+        text += std::to_string(limbs.back());
+        text += '.';
+        std::vector<uint32_t> fraction(limbs.begin(), limbs.end() - 1);
+        for (int d = 0; d < digits; d++) {
+            uint64_t carry = 0;
+            for (size_t i = 0; i < fraction.size(); i++) {
+                uint64_t product = static_cast<uint64_t>(fraction[i]) * 10 + carry;
+                fraction[i] = static_cast<uint32_t>(product);
+                carry = product >> 32;
+            }
+            text += static_cast<char>('0' + carry);
+        }
+        return text;
+    }
+
+    // Largest multiple of 2^-fractionBits not above the value
+    FixedPoint floorTo(int fractionBits) const {
+        FixedPoint result = *this;
+        long long dropped = 32LL * (size() - 1) - fractionBits;
+        bool inexact = false;
+        for (int i = 0; i < size() && dropped > 0; i++, dropped -= 32) {
+            uint32_t mask = dropped >= 32 ? 0xFFFFFFFFu : (1u << dropped) - 1;
+            inexact = inexact || (result.limbs[i] & mask) != 0;
+            result.limbs[i] &= ~mask;
+        }
+        if (negative && inexact) {
+            result = result - FixedPoint::fromFloatExp(FloatExp(1.0, -fractionBits), size());
+        }
+        return result;
+    }
+
+    size_t hash() const {
+        size_t seed = negative && !isZero() ? 1 : 0;
+        for (uint32_t limb : limbs) {
+            seed ^= limb + 0x9e3779b9u + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+
+    bool isZero() const {
+        return std::all_of(limbs.begin(), limbs.end(), [](uint32_t limb) { return limb == 0; });
+    }
+
+    FixedPoint operator-() const {
+        FixedPoint result = *this;
+        result.negative = !negative;
+        return result;
+    }
+
+    friend FixedPoint operator+(const FixedPoint& a, const FixedPoint& b) {
+        int limbCount = std::max(a.size(), b.size());
+        const FixedPoint x = a.size() == limbCount ? a : a.withLimbs(limbCount);
+        const FixedPoint y = b.size() == limbCount ? b : b.withLimbs(limbCount);
+        FixedPoint result(limbCount);
+        if (x.negative == y.negative) {
+            result.negative = x.negative;
+            uint64_t carry = 0;
+            for (int i = 0; i < limbCount; i++) {
+                uint64_t sum = static_cast<uint64_t>(x.limbs[i]) + y.limbs[i] + carry;
+                result.limbs[i] = static_cast<uint32_t>(sum);
+                carry = sum >> 32;
+            }
+            return result;
+        }
+        // Opposite signs: subtract the smaller magnitude from the larger
+        bool xLarger = compareMagnitude(x, y) >= 0;
+        const FixedPoint& larger = xLarger ? x : y;
+        const FixedPoint& smaller = xLarger ? y : x;
+        result.negative = larger.negative;
+        int64_t borrow = 0;
+        for (int i = 0; i < limbCount; i++) {
+            int64_t difference = static_cast<int64_t>(larger.limbs[i]) - smaller.limbs[i] - borrow;
+            borrow = difference < 0;
+            result.limbs[i] = static_cast<uint32_t>(difference + (borrow << 32));
+        }
+        return result;
+    }
+
+    friend FixedPoint operator-(const FixedPoint& a, const FixedPoint& b) { return a + (-b); }
+
+    // Truncated to the precision of the wider operand
+    friend FixedPoint operator*(const FixedPoint& a, const FixedPoint& b) {
+        int n = a.size();
+        int m = b.size();
+        std::vector<uint32_t> product(n + m, 0u);
+        for (int i = 0; i < n; i++) {
+            uint64_t carry = 0;
+            uint64_t ai = a.limbs[i];
+            if (ai == 0) {
+                continue;
+            }
+            for (int j = 0; j < m; j++) {
+                uint64_t t = ai * b.limbs[j] + product[i + j] + carry;
+                product[i + j] = static_cast<uint32_t>(t);
+                carry = t >> 32;
+            }
+            product[i + m] = static_cast<uint32_t>(carry);
+        }
+        // The product has n + m - 2 fraction limbs; keep the top ones that fit
+        int limbCount = std::max(n, m);
+        FixedPoint result(limbCount);
+        result.negative = a.negative != b.negative;
+        int first = n + m - 1 - limbCount;
+        for (int i = 0; i < limbCount; i++) {
+            result.limbs[i] = product[first + i];
+        }
+        return result;
+    }
+
+    bool operator==(const FixedPoint& other) const {
+        return limbs == other.limbs && (negative == other.negative || isZero());
+    }
+
+    bool operator!=(const FixedPoint& other) const { return !(*this == other); }
+
+    friend bool operator<(const FixedPoint& a, const FixedPoint& b) {
+        FixedPoint difference = a - b;
+        return difference.negative && !difference.isZero();
+    }
+
+private:
+    static int compareMagnitude(const FixedPoint& a, const FixedPoint& b) {
+        for (int i = a.size() - 1; i >= 0; i--) {
+            if (a.limbs[i] != b.limbs[i]) {
+                return a.limbs[i] < b.limbs[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    bool negative;
+    std::vector<uint32_t> limbs;  // Least significant first
+};
+
+// Fraction limbs that resolve a given step to `guardBits` bits below it
+inline int limbsForStep(const FloatExp& step, int guardBits) {
+    long long fractionBits = std::max(0LL, -step.exponent + guardBits);
+    return static_cast<int>((fractionBits + 31) / 32) + 1;
+}
@@ -0,0 +1,809 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "mandelbrot.h"
+// MANDEL_NO_FORMULA_JIT builds without it, as the MANDEL_FORMULA_JIT CMake option does
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(MANDEL_NO_FORMULA_JIT)
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FORMULA_JIT_SUPPORTED 1
+#endif
+
+// Formulas typed in at run time, compiled to native kernels.
+//
+// A formula such as "z^3 - z + c" is parsed into a tree, and the tree is
+// written out as C++ for a formula policy type (see mandelbrot.h): step() as
+// straight-line arithmetic on real and imaginary parts, leaving out the parts
+// known to be zero and sharing repeated terms, and derivative() by forward
+// differentiation of the same tree. That source is compiled with the compiler
+// and flags this program was built with into a shared object, whose one
+// function fills a KernelTable from KernelTable::of, so a typed formula gets
+// the same SIMD loop at every width and precision as a built-in one. Its table
+// is registered in the FormulaRegistry under the formula's text. Objects are
+// cached on disk under a hash of their source, so each formula compiles once
+// per machine, which takes a few seconds.
+//
+// Formulas are in z and c, with numbers, i, + - * /, ^ with a whole exponent,
+// implicit multiplication ("2z", "i abs(im(z))"), conj(), abs(), re() and im().
+// abs() takes the absolute value of the real and imaginary parts apart, as the
+// burning ship does. Points escape past |z| = 2, and the distance estimate
+// takes c to be added once, as in the built-in formulas.
+
+// Compiler, flags and header directory the build configures, for a build
+// without CMake: the system compiler and the current directory
+#ifndef MANDEL_JIT_CXX
+#define MANDEL_JIT_CXX "c++"
+#endif
+#ifndef MANDEL_JIT_FLAGS
+#define MANDEL_JIT_FLAGS "-O3 -ffp-contract=off"
+#endif
+#ifndef MANDEL_JIT_INCLUDE_DIR
+#define MANDEL_JIT_INCLUDE_DIR "."
+#endif
+
+// Largest exponent ^ takes; powers are unrolled into multiplications
+const int FORMULA_MAX_EXPONENT = 64;
+
+struct FormulaNode {
+    enum Kind { NUMBER, Z, C, I, ADD, SUBTRACT, MULTIPLY, DIVIDE, NEGATE, POWER, CONJ, ABS, RE, IM };
+
+    Kind kind;
+    double value = 0.0;  // NUMBER
+    int exponent = 0;    // POWER
+    int left = -1;       // Operands, as indices into the tree
+    int right = -1;
+};
+
+// Recursive descent over
+//   expression := term (('+' | '-') term)*
+//   term       := unary (('*' | '/')? unary)*
+//   unary      := '-' unary | power
+//   power      := primary ('^' integer)?
+//   primary    := number | z | c | i | function '(' expression ')' | '(' expression ')'
+class FormulaParser {
+public:
+    // The tree, root last; false with a message naming the column on a mistake
+    bool parse(const std::string& text, std::vector<FormulaNode>& tree, std::string& error) {
+        source = &text;
+        position = 0;
+        nodes.clear();
+        message.clear();
+        int root = expression();
+        skipSpace();
+        if (root >= 0 && position < text.size()) {
+            fail("unexpected '" + std::string(1, text[position]) + "'");
+        }
+        if (!message.empty()) {
+            error = message;
+            return false;
+        }
+        tree.swap(nodes);
+        return true;
+    }
+
+private:
+    int expression() {
+        int left = term();
+        while (left >= 0) {
+            skipSpace();
+            if (accept('+')) {
+                left = node(FormulaNode::ADD, left, term());
+            } else if (accept('-')) {
+                left = node(FormulaNode::SUBTRACT, left, term());
+            } else {
+                break;
+            }
+        }
+        return left;
+    }
+
+    int term() {
+        int left = unary();
+        while (left >= 0) {
+            skipSpace();
+            if (accept('*')) {
+                left = node(FormulaNode::MULTIPLY, left, unary());
+            } else if (accept('/')) {
+                left = node(FormulaNode::DIVIDE, left, unary());
+            } else if (startsPrimary()) {
+                left = node(FormulaNode::MULTIPLY, left, unary());
+            } else {
+                break;
+            }
+        }
+        return left;
+    }
+
+    int unary() {
+        skipSpace();
+        if (accept('-')) {
+            return node(FormulaNode::NEGATE, unary());
+        }
+        return power();
+    }
+
+    int power() {
+        int base = primary();
+        skipSpace();
+        if (base < 0 || !accept('^')) {
+            return base;
+        }
+        skipSpace();
+        size_t start = position;
+        long exponent = 0;
+        while (position < source->size() && std::isdigit(static_cast<unsigned char>((*source)[position]))) {
+            exponent = std::min(exponent * 10 + ((*source)[position++] - '0'), static_cast<long>(INT32_MAX));
+        }
+        if (position == start || exponent > FORMULA_MAX_EXPONENT) {
+            position = start;
+            return fail("exponents are whole numbers from 0 to " + std::to_string(FORMULA_MAX_EXPONENT));
+        }
+        skipSpace();
+        if (position < source->size() && (*source)[position] == '^') {
+            return fail("write (a^b)^c for a power of a power");
+        }
+        FormulaNode result = { FormulaNode::POWER };
+        result.exponent = static_cast<int>(exponent);
+        result.left = base;
+        return add(result);
+    }
+
+    int primary() {
+        skipSpace();
+        if (position == source->size()) {
+            return fail("the formula ends too soon");
+        }
+        char next = (*source)[position];
+        if (std::isdigit(static_cast<unsigned char>(next)) || next == '.') {
+            return number();
+        }
+        if (accept('(')) {
+            int inner = expression();
+            skipSpace();
+            if (inner >= 0 && !accept(')')) {
+                return fail("missing ')'");
+            }
+            return inner;
+        }
+        if (!std::isalpha(static_cast<unsigned char>(next))) {
+            return fail("unexpected '" + std::string(1, next) + "'");
+        }
+
+        size_t start = position;
+        while (position < source->size() && std::isalpha(static_cast<unsigned char>((*source)[position]))) {
+            position++;
+        }
+        std::string name = source->substr(start, position - start);
+        if (name == "z") {
+            return node(FormulaNode::Z);
+        }
+        if (name == "c") {
+            return node(FormulaNode::C);
+        }
+        if (name == "i") {
+            return node(FormulaNode::I);
+        }
+        static const std::map<std::string, FormulaNode::Kind> functions = {
+            { "conj", FormulaNode::CONJ }, { "abs", FormulaNode::ABS }, { "re", FormulaNode::RE },
+            { "im", FormulaNode::IM } };
+        auto function = functions.find(name);
+        if (function == functions.end()) {
+            position = start;
+            return fail("unknown name '" + name + "'");
+        }
+        skipSpace();
+        if (!accept('(')) {
+            return fail(name + " needs '('");
+        }
+        int argument = expression();
+        skipSpace();
+        if (argument >= 0 && !accept(')')) {
+            return fail("missing ')'");
+        }
+        return node(function->second, argument);
+    }
+
+    // Digits, an optional fraction and an optional exponent
+    int number() {
+        size_t start = position;
+        auto digits = [&]() {
+            size_t first = position;
+            while (position < source->size() && std::isdigit(static_cast<unsigned char>((*source)[position]))) {
+                position++;
+            }
+            return position - first;
+        };
+        size_t count = digits();
+        if (accept('.')) {
+            count += digits();
+        }
+        if (count == 0) {
+            position = start;
+            return fail("malformed number");
+        }
+        if (position < source->size() && ((*source)[position] == 'e' || (*source)[position] == 'E')) {
+            size_t mark = position++;
+            if (position < source->size() && ((*source)[position] == '+' || (*source)[position] == '-')) {
+                position++;
+            }
+            if (digits() == 0) {
+                position = mark;  // An 'e' with no digits is not part of the number
+            }
+        }
+        FormulaNode result = { FormulaNode::NUMBER };
+        result.value = std::strtod(source->substr(start, position - start).c_str(), nullptr);
+        if (!std::isfinite(result.value)) {
+            position = start;
+            return fail("number out of range");
+        }
+        return add(result);
+    }
+
+    bool startsPrimary() const {
+        if (position == source->size()) {
+            return false;
+        }
+        unsigned char next = static_cast<unsigned char>((*source)[position]);
+        return std::isalnum(next) || next == '.' || next == '(';
+    }
+
+    void skipSpace() {
+        while (position < source->size() && std::isspace(static_cast<unsigned char>((*source)[position]))) {
+            position++;
+        }
+    }
+
+    bool accept(char expected) {
+        if (position < source->size() && (*source)[position] == expected) {
+            position++;
+            return true;
+        }
+        return false;
+    }
+
+    int node(FormulaNode::Kind kind, int left = -1, int right = -1) {
+        bool binary = kind == FormulaNode::ADD || kind == FormulaNode::SUBTRACT || kind == FormulaNode::MULTIPLY ||
+                      kind == FormulaNode::DIVIDE;
+        bool unaryKind = kind == FormulaNode::NEGATE || kind >= FormulaNode::POWER;
+        if ((binary || unaryKind) && left < 0) {
+            return -1;
+        }
+        if (binary && right < 0) {
+            return -1;
+        }
+        FormulaNode result = { kind };
+        result.left = left;
+        result.right = right;
+        return add(result);
+    }
+
+    int add(const FormulaNode& result) {
+        nodes.push_back(result);
+        return static_cast<int>(nodes.size()) - 1;
+    }
+
+    // The first mistake wins; returns -1 for the callers to pass up
+    int fail(const std::string& what) {
+        if (message.empty()) {
+            message = what + " at column " + std::to_string(position + 1);
+        }
+        return -1;
+    }
+
+    const std::string* source = nullptr;
+    size_t position = 0;
+    std::vector<FormulaNode> nodes;
+    std::string message;
+};
+
+// How many times log |z| multiplies per step far out, reading z as degree 1
+// and constants as 0; exact for polynomials, an estimate when terms cancel
+inline int formulaDegree(const std::vector<FormulaNode>& tree, int index) {
+    const FormulaNode& node = tree[index];
+    switch (node.kind) {
+        case FormulaNode::Z: return 1;
+        case FormulaNode::NUMBER:
+        case FormulaNode::C:
+        case FormulaNode::I: return 0;
+        case FormulaNode::ADD:
+        case FormulaNode::SUBTRACT:
+            return std::max(formulaDegree(tree, node.left), formulaDegree(tree, node.right));
+        case FormulaNode::MULTIPLY: return formulaDegree(tree, node.left) + formulaDegree(tree, node.right);
+        case FormulaNode::DIVIDE: return formulaDegree(tree, node.left) - formulaDegree(tree, node.right);
+        case FormulaNode::POWER: return formulaDegree(tree, node.left) * node.exponent;
+        default: return formulaDegree(tree, node.left);
+    }
+}
+
+// Writes a tree as the body of step() or derivative(). Every value is a pair of
+// parts, each the name of a const Value or empty where it is known to be zero,
+// so zero terms drop out as the code is written. Identical expressions are
+// written once.
+class FormulaCodeWriter {
+public:
+    typedef std::string Part;
+
+    struct Complex {
+        Part real;
+        Part imag;
+    };
+
+    // A value and its derivative along dz
+    struct Dual {
+        Complex value;
+        Complex tangent;
+    };
+
+    // With tangents, z carries dz = (dx, dy); without, x^2 and y^2 come from the kernel
+    explicit FormulaCodeWriter(bool tangents) : tangents(tangents) {}
+
+    Dual write(const std::vector<FormulaNode>& tree, int index) {
+        const FormulaNode& node = tree[index];
+        switch (node.kind) {
+            case FormulaNode::NUMBER: return { { constant(node.value), "" }, {} };
+            case FormulaNode::Z:
+                return { { "x", "y" }, tangents ? Complex{ "dx", "dy" } : Complex{} };
+            case FormulaNode::C: return { { "cReal", "cImag" }, {} };
+            case FormulaNode::I: return { { "", constant(1.0) }, {} };
+            case FormulaNode::ADD: {
+                Dual a = write(tree, node.left), b = write(tree, node.right);
+                return { add(a.value, b.value), add(a.tangent, b.tangent) };
+            }
+            case FormulaNode::SUBTRACT: {
+                Dual a = write(tree, node.left), b = write(tree, node.right);
+                return { subtract(a.value, b.value), subtract(a.tangent, b.tangent) };
+            }
+            case FormulaNode::MULTIPLY: return multiply(write(tree, node.left), write(tree, node.right));
+            case FormulaNode::DIVIDE: return divide(write(tree, node.left), write(tree, node.right));
+            case FormulaNode::NEGATE: {
+                Dual a = write(tree, node.left);
+                return { negate(a.value), negate(a.tangent) };
+            }
+            case FormulaNode::POWER: return power(write(tree, node.left), node.exponent);
+            case FormulaNode::CONJ: {
+                Dual a = write(tree, node.left);
+                return { { a.value.real, negate(a.value.imag) }, { a.tangent.real, negate(a.tangent.imag) } };
+            }
+            case FormulaNode::ABS: {
+                // Each tangent part flips where its value part is negative
+                Dual a = write(tree, node.left);
+                return { { abs(a.value.real), abs(a.value.imag) },
+                         { fold(a.tangent.real, a.value.real), fold(a.tangent.imag, a.value.imag) } };
+            }
+            case FormulaNode::RE: {
+                Dual a = write(tree, node.left);
+                return { { a.value.real, "" }, { a.tangent.real, "" } };
+            }
+            case FormulaNode::IM: {
+                Dual a = write(tree, node.left);
+                return { { a.value.imag, "" }, { a.tangent.imag, "" } };
+            }
+        }
+        return {};
+    }
+
+    std::string code() const { return out.str(); }
+
+    // Set when the formula divides by something known to be zero
+    bool dividesByZero() const { return divisionByZero; }
+
+    // A part as an expression, zero included
+    static std::string expression(const Part& part) { return part.empty() ? "Pack::broadcast(0.0)" : part; }
+
+private:
+    Part let(const std::string& value) {
+        auto known = names.find(value);
+        if (known != names.end()) {
+            return known->second;
+        }
+        Part name = "t" + std::to_string(names.size());
+        out << "        const Value " << name << " = " << value << ";\n";
+        names[value] = name;
+        return name;
+    }
+
+    Part constant(double value) {
+        if (value == 0.0) {
+            return "";
+        }
+        std::ostringstream literal;
+        literal.precision(17);
+        literal << value;
+        std::string text = literal.str();
+        if (text.find_first_of(".e") == std::string::npos) {
+            text += ".0";
+        }
+        Part name = let("Pack::broadcast(" + text + ")");
+        if (value == 1.0) {
+            one = name;
+        }
+        return name;
+    }
+
+    Part add(const Part& a, const Part& b) {
+        if (a.empty() || b.empty()) {
+            return a.empty() ? b : a;
+        }
+        if (negative(a) || negative(b)) {
+            return negative(a) ? (negative(b) ? negate(add(magnitude(a), magnitude(b))) : subtract(b, magnitude(a)))
+                               : subtract(a, magnitude(b));
+        }
+        return a == b ? let("Pack::twice(" + a + ")") : let(ordered(a, " + ", b));
+    }
+
+    Part subtract(const Part& a, const Part& b) {
+        if (a.empty() || b.empty()) {
+            return a.empty() ? negate(b) : a;
+        }
+        if (negative(b)) {
+            return add(a, magnitude(b));
+        }
+        return negative(a) ? negate(add(magnitude(a), b)) : let(a + " - " + b);
+    }
+
+    // Negation is kept as a sign on the part, so it folds into the sums and products that use it
+    Part negate(const Part& a) {
+        if (a.empty()) {
+            return a;
+        }
+        return negative(a) ? magnitude(a) : "-" + a;
+    }
+
+    Part multiply(const Part& a, const Part& b) {
+        if (a.empty() || b.empty()) {
+            return "";
+        }
+        if (negative(a) || negative(b)) {
+            Part product = multiply(magnitude(a), magnitude(b));
+            return negative(a) != negative(b) ? negate(product) : product;
+        }
+        if (a == one || b == one) {
+            return a == one ? b : a;
+        }
+        if (a == b && absolutes.count(a)) {
+            return multiply(absolutes[a], absolutes[a]);  // |a|^2 = a^2
+        }
+        if (!tangents && a == b && (a == "x" || a == "y")) {
+            return a + "2";  // The kernel's own x * x and y * y
+        }
+        return let(ordered(a, " * ", b));
+    }
+
+    Part divide(const Part& a, const Part& b) {
+        if (a.empty()) {
+            return a;
+        }
+        if (negative(a) || negative(b)) {
+            Part quotient = divide(magnitude(a), magnitude(b));
+            return negative(a) != negative(b) ? negate(quotient) : quotient;
+        }
+        return b == one ? a : let(a + " / " + b);
+    }
+
+    Part abs(const Part& a) {
+        if (a.empty()) {
+            return a;
+        }
+        Part result = let("Pack::abs(" + magnitude(a) + ")");
+        absolutes[result] = magnitude(a);
+        return result;
+    }
+
+    Part fold(const Part& tangent, const Part& value) {
+        if (tangent.empty() || value.empty()) {
+            return tangent;
+        }
+        Part sign = named(value), slope = named(tangent);
+        return let("Pack::select(" + sign + " < Pack::broadcast(0.0), -" + slope + ", " + slope + ")");
+    }
+
+    static bool negative(const Part& a) { return !a.empty() && a[0] == '-'; }
+    static Part magnitude(const Part& a) { return negative(a) ? a.substr(1) : a; }
+
+    // A negated part as a name of its own
+    Part named(const Part& a) { return negative(a) ? let(a) : a; }
+
+    // Commutative operations are written one way round, so a * b and b * a are shared
+    static std::string ordered(const Part& a, const char* operation, const Part& b) {
+        return a < b ? a + operation + b : b + operation + a;
+    }
+
+    Complex add(const Complex& a, const Complex& b) { return { add(a.real, b.real), add(a.imag, b.imag) }; }
+
+    Complex subtract(const Complex& a, const Complex& b) {
+        return { subtract(a.real, b.real), subtract(a.imag, b.imag) };
+    }
+
+    Complex negate(const Complex& a) { return { negate(a.real), negate(a.imag) }; }
+
+    Complex multiply(const Complex& a, const Complex& b) {
+        return { subtract(multiply(a.real, b.real), multiply(a.imag, b.imag)),
+                 add(multiply(a.real, b.imag), multiply(a.imag, b.real)) };
+    }
+
+    Complex divide(const Complex& a, const Complex& b) {
+        if (b.imag.empty()) {
+            if (b.real.empty()) {
+                divisionByZero = true;
+                return {};
+            }
+            return { divide(a.real, b.real), divide(a.imag, b.real) };
+        }
+        if (b.real.empty()) {
+            // a / (i b) = -i a / b
+            return { divide(a.imag, b.imag), negate(divide(a.real, b.imag)) };
+        }
+        Part scale = add(multiply(b.real, b.real), multiply(b.imag, b.imag));
+        return { divide(add(multiply(a.real, b.real), multiply(a.imag, b.imag)), scale),
+                 divide(subtract(multiply(a.imag, b.real), multiply(a.real, b.imag)), scale) };
+    }
+
+    Dual multiply(const Dual& a, const Dual& b) {
+        return { multiply(a.value, b.value), add(multiply(a.tangent, b.value), multiply(a.value, b.tangent)) };
+    }
+
+    // (a / b)' = (a' - (a / b) b') / b
+    Dual divide(const Dual& a, const Dual& b) {
+        Complex quotient = divide(a.value, b.value);
+        return { quotient, divide(subtract(a.tangent, multiply(quotient, b.tangent)), b.value) };
+    }
+
+    // By squaring, so z^8 is three multiplications
+    Dual power(Dual base, int exponent) {
+        if (exponent == 0) {
+            return { { constant(1.0), "" }, {} };
+        }
+        Dual result = {};
+        bool first = true;
+        while (true) {
+            if (exponent & 1) {
+                result = first ? base : multiply(result, base);
+                first = false;
+            }
+            exponent >>= 1;
+            if (exponent == 0) {
+                return result;
+            }
+            base = multiply(base, base);
+        }
+    }
+
+    bool tangents;
+    bool divisionByZero = false;
+    Part one;  // The name 1 was given, once it has been written
+    std::ostringstream out;
+    std::map<std::string, Part> names;  // Each expression written so far, by its text
+    std::map<Part, Part> absolutes;  // What each Pack::abs was taken of
+};
+
+// The C++ source of a shared object holding the kernels for a formula, or an
+// empty string with the reason in error
+inline std::string formulaSource(const std::string& text, std::string& error) {
+    for (char c : text) {
+        if (!std::isprint(static_cast<unsigned char>(c))) {
+            error = "formulas are plain ASCII text";
+            return "";
+        }
+    }
+    std::vector<FormulaNode> tree;
+    if (!FormulaParser().parse(text, tree, error)) {
+        return "";
+    }
+    int root = static_cast<int>(tree.size()) - 1;
+    int degree = formulaDegree(tree, root);
+    if (degree < 2) {
+        error = "the formula needs a power of z of 2 or more, such as z^2";
+        return "";
+    }
+
+    FormulaCodeWriter step(false), derivative(true);
+    FormulaCodeWriter::Dual next = step.write(tree, root);
+    FormulaCodeWriter::Dual slope = derivative.write(tree, root);
+    if (step.dividesByZero()) {
+        error = "the formula divides by zero";
+        return "";
+    }
+
+    // New values go to temporaries first, since the right-hand sides read the old ones
+    std::ostringstream source;
+    source << "// Generated from the formula " << text << "\n"
+           << "#include \"mandelbrot.h\"\n"
+           << "\n"
+           << "struct UserFormula {\n"
+           << "    static constexpr int DEGREE = " << degree << ";\n"
+           << "\n"
+           << "    template <typename Pack, typename Value>\n"
+           << "    static void step(Value& x, Value& y, const Value& x2, const Value& y2, const Value& cReal,\n"
+           << "                     const Value& cImag) {\n"
+           << step.code()
+           << "        const Value nextX = " << FormulaCodeWriter::expression(next.value.real) << ";\n"
+           << "        y = " << FormulaCodeWriter::expression(next.value.imag) << ";\n"
+           << "        x = nextX;\n"
+           << "    }\n"
+           << "\n"
+           << "    template <typename Pack, typename Value>\n"
+           << "    static void derivative(Value& dx, Value& dy, const Value& x, const Value& y, const Value& cReal,\n"
+           << "                           const Value& cImag) {\n"
+           << derivative.code()
+           << "        const Value nextDx = " << FormulaCodeWriter::expression(slope.tangent.real) << ";\n"
+           << "        dy = " << FormulaCodeWriter::expression(slope.tangent.imag) << ";\n"
+           << "        dx = nextDx;\n"
+           << "    }\n"
+           << "};\n"
+           << "\n"
+           << "extern \"C\" bool mandelsoundFormulaKernels(KernelTable* table, unsigned long tableBytes) {\n"
+           << "    if (tableBytes != sizeof(KernelTable)) {\n"
+           << "        return false;\n"
+           << "    }\n"
+           << "    *table = KernelTable::of<UserFormula>();\n"
+           << "    return true;\n"
+           << "}\n";
+    return source.str();
+}
+
+// Where compiled formulas are kept: $MANDELSOUND_FORMULA_CACHE, or
+// mandelsound-formulas in the user's cache directory
+inline std::string formulaCacheDirectory() {
+    if (const char* directory = std::getenv("MANDELSOUND_FORMULA_CACHE")) {
+        return directory;
+    }
+    if (const char* cache = std::getenv("XDG_CACHE_HOME")) {
+        return std::string(cache) + "/mandelsound-formulas";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/mandelsound-formulas";
+    }
+    return "mandelsound-formulas";
+}
+
+// For the shell, in single quotes
+inline std::string shellQuote(const std::string& text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// FNV-1a, to name cache entries after what went into them
+inline uint64_t formulaHash(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Every header from the source tree that text includes, directly or through other
+// headers, each once, into out
+inline void appendIncludedHeaders(const std::string& text, std::ostream& out, std::vector<std::string>& seen) {
+    std::istringstream lines(text);
+    std::string line;
+    const std::string directive = "#include \"";
+    while (std::getline(lines, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, directive.size(), directive) != 0) {
+            continue;
+        }
+        size_t end = line.find('"', start + directive.size());
+        if (end == std::string::npos) {
+            continue;
+        }
+        std::string header = line.substr(start + directive.size(), end - start - directive.size());
+        if (std::find(seen.begin(), seen.end(), header) != seen.end()) {
+            continue;
+        }
+        seen.push_back(header);
+        std::ostringstream contents;
+        contents << std::ifstream(std::string(MANDEL_JIT_INCLUDE_DIR) + "/" + header).rdbuf();
+        out << contents.str();
+        appendIncludedHeaders(contents.str(), out, seen);
+    }
+}
+
+// Compile a formula's source, or take it from the cache, and load its kernels
+inline bool loadFormulaKernels(const std::string& source, KernelTable& kernels, std::string& error) {
+#if defined(FORMULA_JIT_SUPPORTED)
+    std::string directory = formulaCacheDirectory();
+    for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1)) {
+        std::string parent = directory.substr(0, slash);
+        if (mkdir(parent.c_str(), 0700) != 0 && errno != EEXIST) {
+            error = "could not create " + parent;
+            return false;
+        }
+        if (slash == std::string::npos) {
+            break;
+        }
+    }
+
+    // The command and every header the source pulls in are part of the name, so other
+    // flags or any change to the kernels compile afresh
+    std::string command = shellQuote(MANDEL_JIT_CXX) + " -std=c++17 " + MANDEL_JIT_FLAGS + " -fPIC -shared -I" +
+                          shellQuote(MANDEL_JIT_INCLUDE_DIR);
+    std::ostringstream inputs;
+    inputs << command << source;
+    std::vector<std::string> headers;
+    appendIncludedHeaders(source, inputs, headers);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(formulaHash(inputs.str())));
+    std::string base = directory + "/" + name;
+    std::string library = base + ".so";
+
+    if (access(library.c_str(), R_OK) != 0) {
+        // Built under a name of this process's own, then renamed, so other processes never load half an object
+        std::string pending = base + "." + std::to_string(getpid());
+        std::ofstream(pending + ".cpp") << source;
+        std::string log = pending + ".log";
+        command += " -o " + shellQuote(pending + ".so") + " " + shellQuote(pending + ".cpp") + " > " +
+                   shellQuote(log) + " 2>&1";
+        bool compiled = std::system(command.c_str()) == 0 && std::rename((pending + ".so").c_str(),
+                                                                         library.c_str()) == 0;
+        if (!compiled) {
+            std::ifstream output(log);
+            std::string line;
+            error = "compiling the formula failed";
+            for (int lines = 0; lines < 8 && std::getline(output, line); lines++) {
+                error += "\n" + line;
+            }
+        }
+        std::remove((pending + ".cpp").c_str());
+        std::remove((pending + ".so").c_str());
+        std::remove(log.c_str());
+        if (!compiled) {
+            return false;
+        }
+    }
+
+    // Never closed: the kernels may run for as long as the program does
+    void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        error = dlerror();
+        return false;
+    }
+    typedef bool (*FillKernels)(KernelTable*, unsigned long);
+    FillKernels fill = reinterpret_cast<FillKernels>(dlsym(handle, "mandelsoundFormulaKernels"));
+    if (fill == nullptr || !fill(&kernels, sizeof(KernelTable))) {
+        error = library + " was built for another version of the kernels";
+        return false;
+    }
+    return true;
+#else
+    (void)source;
+    (void)kernels;
+    error = "this build cannot compile formulas";
+    return false;
+#endif
+}
+
+// Compile a formula and register it under its text, even if it is there already
+inline FormulaId compileFormula(const std::string& text, std::string& error) {
+    std::string source = formulaSource(text, error);
+    KernelTable kernels;
+    if (source.empty() || !loadFormulaKernels(source, kernels, error)) {
+        return -1;
+    }
+    FormulaId id = FormulaRegistry::instance().add(text, text, false, kernels);
+    if (id < 0) {
+        error = "no room for more formulas";
+    }
+    return id;
+}
+
+// A formula by name, by the text it was compiled from, or compiled now; -1 with
+// the reason in error if the text is no formula
+inline FormulaId findOrCompileFormula(const std::string& text, std::string& error) {
+    FormulaId id = FormulaRegistry::instance().find(text);
+    return id >= 0 ? id : compileFormula(text, error);
+}
@@ -1,4 +1,5 @@
 #include <SDL2/SDL.h>
+#include <algorithm>
 #include <complex>
 #include <cmath>
 #include <vector>
@@ -106,7 +107,8 @@ std::vector<Sint16> createMandelbrotSound(int iterations, double real, double im
         // Apply the envelope
         sample *= envelope;
         
-        // Convert to 16-bit signed
+        // Convert to 16-bit signed, clipping since the vibrato can push past full scale
+        sample = std::max(-1.0, std::min(1.0, sample));
         buffer[i] = static_cast<Sint16>(sample * 32767);
     }
     
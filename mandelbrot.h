@@ -0,0 +1,652 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "double_double.h"
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Escape-time kernel shared by the interactive app and the headless renderer.
+//
+// The kernel is one template, instantiated per formula, scalar type, feature set
+// and SIMD width, so every combination compiles to its own loop with no runtime
+// branches on options. A dispatch table picks the instantiation a render needs.
+
+// Optional outputs and tests, combined as a bit set
+enum KernelFeature : unsigned {
+    KERNEL_SMOOTH = 1,       // Continuous iteration count
+    KERNEL_DISTANCE = 2,     // Exterior distance estimate (tracks dz/dc)
+    KERNEL_PERIODICITY = 4,  // Stop early on orbits that have settled into a cycle
+    KERNEL_JULIA = 8,        // Julia set: z starts at the point and c is a constant (dz/dz0 for the distance)
+    KERNEL_FEATURE_COMBINATIONS = 16
+};
+
+// The c of a Julia set; kernels without KERNEL_JULIA ignore it
+struct JuliaParameter {
+    DoubleDouble real;
+    DoubleDouble imag;
+};
+
+// Everything the kernel reports for one point
+struct EscapeResult {
+    int iterations;  // Escape iteration; maxIter inside the set
+    float smooth;    // Continuous count close to iterations, below maxIter; maxIter inside the set
+    float distance;  // Lower bound on the distance to the set; 0 inside or without KERNEL_DISTANCE
+};
+
+// Escaped orbits run this many steps past the bailout before the smooth count is
+// read off, so |z| is large enough for the count to be continuous to the eye
+const int SMOOTH_EXTRA_ITERATIONS = 3;
+
+// Bytes of one SIMD register: AVX where the target has it, SSE2 otherwise
+#ifdef __AVX__
+const int KERNEL_VECTOR_BYTES = 32;
+#else
+const int KERNEL_VECTOR_BYTES = 16;
+#endif
+
+// Lanes that fill one register; types the vector extensions cannot hold run scalar.
+// A double-double pack is a pair of double registers.
+template <typename Real>
+constexpr int nativeKernelLanes() {
+    return std::is_same<Real, float>::value || std::is_same<Real, double>::value
+        ? KERNEL_VECTOR_BYTES / static_cast<int>(sizeof(Real))
+        : std::is_same<Real, DoubleDouble>::value ? KERNEL_VECTOR_BYTES / static_cast<int>(sizeof(double)) : 1;
+}
+
+// Relative rounding step of each kernel type
+template <typename Real>
+constexpr double kernelEpsilon() {
+    return static_cast<double>(std::numeric_limits<Real>::epsilon());
+}
+
+template <>
+constexpr double kernelEpsilon<DoubleDouble>() {
+    return 4.93038065763132e-32;  // 2^-104
+}
+
+// Round a coordinate to the kernel type
+template <typename Real>
+inline Real toKernelReal(const DoubleDouble& value) {
+    return static_cast<Real>(value.hi) + static_cast<Real>(value.lo);
+}
+
+template <>
+inline DoubleDouble toKernelReal<DoubleDouble>(const DoubleDouble& value) {
+    return value;
+}
+
+// Arithmetic on a pack of Lanes points. GCC/Clang vector extensions lower the
+// vector packs to whatever the target offers; Lanes == 1 is plain scalar code.
+template <typename Real, int Lanes>
+struct KernelPack {
+    typedef typename std::conditional<sizeof(Real) == 4, int32_t, int64_t>::type MaskElement;
+    typedef Real Value __attribute__((vector_size(Lanes * sizeof(Real))));
+    typedef MaskElement Mask __attribute__((vector_size(Lanes * sizeof(Real))));
+    typedef Mask Counter;
+
+    static Value broadcast(Real r) { return Value{} + r; }
+    static Value twice(const Value& v) { return v + v; }
+    static Value abs(const Value& v) { return reinterpret_cast<Value>(reinterpret_cast<Mask>(v) & ~signBits()); }
+    static Mask allLanes() { return Value{} == Value{}; }
+    static Real lane(const Value& v, int i) { return v[i]; }
+    static int lane(const Mask& m, int i) { return static_cast<int>(m[i]); }
+    static void setLane(Value& v, int i, Real r) { v[i] = r; }
+
+    // Lanes of a where mask is set, lanes of b elsewhere
+    static Value select(const Mask& mask, const Value& a, const Value& b) {
+        return reinterpret_cast<Value>((reinterpret_cast<Mask>(a) & mask) | (reinterpret_cast<Mask>(b) & ~mask));
+    }
+
+    static void clear(Mask& mask, const Mask& lanes) { mask &= ~lanes; }
+
+    // -0 in every lane; broadcast(-0.0) would round to +0, which it adds to
+    static Mask signBits() { return reinterpret_cast<Mask>(-Value{}); }
+
+    static bool any(const Mask& mask) {
+#if defined(__AVX__)
+        if constexpr (sizeof(Mask) == 32) {
+            return _mm256_movemask_ps(reinterpret_cast<__m256>(mask)) != 0;
+        }
+#endif
+#if defined(__SSE2__)
+        if constexpr (sizeof(Mask) == 16) {
+            return _mm_movemask_ps(reinterpret_cast<__m128>(mask)) != 0;
+        }
+#endif
+        MaskElement bits = 0;
+        for (int i = 0; i < Lanes; i++) {
+            bits |= mask[i];
+        }
+        return bits != 0;
+    }
+
+    // Set lanes of a mask are -1, so subtracting counts them
+    static void count(Counter& counter, const Mask& mask) { counter -= mask; }
+};
+
+template <typename Real>
+struct KernelPack<Real, 1> {
+    typedef Real Value;
+    typedef bool Mask;
+    typedef int Counter;
+
+    static Value broadcast(Real r) { return r; }
+    static Value twice(const Value& v) { return v + v; }
+    static Value abs(const Value& v) { return v < Real{} ? -v : v; }
+    static Mask allLanes() { return true; }
+    static Real lane(const Value& v, int) { return v; }
+    static int lane(const Mask& m, int) { return m; }
+    static int lane(const Counter& c, int) { return c; }
+    static void setLane(Value& v, int, Real r) { v = r; }
+    static Value select(Mask mask, const Value& a, const Value& b) { return mask ? a : b; }
+    static void clear(Mask& mask, Mask lanes) { mask = mask && !lanes; }
+    static bool any(Mask mask) { return mask; }
+    static void count(Counter& counter, Mask mask) { counter += mask; }
+};
+
+// Double-double lanes: a high and a low register, with the masks of plain doubles
+template <int Lanes>
+struct KernelPack<DoubleDouble, Lanes> {
+    typedef KernelPack<double, Lanes> Parts;
+    typedef DoubleDoubleT<typename Parts::Value> Value;
+    typedef typename Parts::Mask Mask;
+    typedef typename Parts::Counter Counter;
+
+    static Value broadcast(const DoubleDouble& r) { return Value(Parts::broadcast(r.hi), Parts::broadcast(r.lo)); }
+    static Value twice(const Value& v) { return v.twice(); }
+    static Value abs(const Value& v) { return select(v.hi < typename Parts::Value{}, -v, v); }
+    static Mask allLanes() { return Parts::allLanes(); }
+    static double lane(const Value& v, int i) { return v.hi[i] + v.lo[i]; }
+    static int lane(const Mask& m, int i) { return Parts::lane(m, i); }
+    static void setLane(Value& v, int i, const DoubleDouble& r) {
+        v.hi[i] = r.hi;
+        v.lo[i] = r.lo;
+    }
+    static Value select(const Mask& mask, const Value& a, const Value& b) {
+        return Value(Parts::select(mask, a.hi, b.hi), Parts::select(mask, a.lo, b.lo));
+    }
+    static void clear(Mask& mask, const Mask& lanes) { Parts::clear(mask, lanes); }
+    static bool any(const Mask& mask) { return Parts::any(mask); }
+    static void count(Counter& counter, const Mask& mask) { Parts::count(counter, mask); }
+};
+
+// Escape-time formulas, as policy types the kernel is instantiated with, so each
+// gets its own SIMD loop. step() takes z = x + iy to f(z) + c, given x^2 and y^2,
+// which the bailout test has already computed. derivative() takes dz to f'(z) dz
+// for the distance estimate, given z and c; for the formulas that fold z it is
+// the derivative of the square the fold feeds, which keeps the estimate's scale.
+// The kernel adds dc itself, so c is taken to be added to f. DEGREE is how
+// many times log |z| grows per step far out, which the smooth count divides out.
+// All of them escape beyond |z| = 2 for any c in view.
+
+// z^2 + c
+struct MandelbrotFormula {
+    static constexpr int DEGREE = 2;
+
+    template <typename Pack, typename Value>
+    static void step(Value& x, Value& y, const Value& x2, const Value& y2, const Value& cReal, const Value& cImag) {
+        y = Pack::twice(x * y) + cImag;
+        x = x2 - y2 + cReal;
+    }
+
+    template <typename Pack, typename Value>
+    static void derivative(Value& dx, Value& dy, const Value& x, const Value& y, const Value&, const Value&) {
+        Value nextDx = Pack::twice(x * dx - y * dy);
+        dy = Pack::twice(x * dy + y * dx);
+        dx = nextDx;
+    }
+};
+
+// z^Power + c, by repeated multiplication, which the compiler unrolls
+template <int Power>
+struct MultibrotFormula {
+    static_assert(Power >= 2, "Multibrot powers start at 2");
+    static constexpr int DEGREE = Power;
+
+    template <typename Pack, typename Value>
+    static void step(Value& x, Value& y, const Value& x2, const Value& y2, const Value& cReal, const Value& cImag) {
+        Value real = x2 - y2;
+        Value imag = Pack::twice(x * y);
+        for (int k = 2; k < Power; k++) {
+            Value nextReal = real * x - imag * y;
+            imag = real * y + imag * x;
+            real = nextReal;
+        }
+        x = real + cReal;
+        y = imag + cImag;
+    }
+
+    template <typename Pack, typename Value>
+    static void derivative(Value& dx, Value& dy, const Value& x, const Value& y, const Value&, const Value&) {
+        // Power z^(Power - 1) dz
+        Value real = x, imag = y;
+        for (int k = 2; k < Power; k++) {
+            Value nextReal = real * x - imag * y;
+            imag = real * y + imag * x;
+            real = nextReal;
+        }
+        Value scale = Pack::broadcast(Power);
+        Value nextDx = (real * dx - imag * dy) * scale;
+        dy = (real * dy + imag * dx) * scale;
+        dx = nextDx;
+    }
+};
+
+// Burning ship: (|x| + i|y|)^2 + c
+struct BurningShipFormula {
+    static constexpr int DEGREE = 2;
+
+    template <typename Pack, typename Value>
+    static void step(Value& x, Value& y, const Value& x2, const Value& y2, const Value& cReal, const Value& cImag) {
+        y = Pack::twice(Pack::abs(x * y)) + cImag;
+        x = x2 - y2 + cReal;
+    }
+
+    template <typename Pack, typename Value>
+    static void derivative(Value& dx, Value& dy, const Value& x, const Value& y,
+                           const Value& cReal, const Value& cImag) {
+        // The fold flips dz's components along with z's
+        const Value zero = Pack::broadcast(0);
+        Value foldedDx = Pack::select(x < zero, -dx, dx);
+        Value foldedDy = Pack::select(y < zero, -dy, dy);
+        dx = foldedDx;
+        dy = foldedDy;
+        MandelbrotFormula::derivative<Pack>(dx, dy, Pack::abs(x), Pack::abs(y), cReal, cImag);
+    }
+};
+
+// Tricorn: conj(z)^2 + c
+struct TricornFormula {
+    static constexpr int DEGREE = 2;
+
+    template <typename Pack, typename Value>
+    static void step(Value& x, Value& y, const Value& x2, const Value& y2, const Value& cReal, const Value& cImag) {
+        y = cImag - Pack::twice(x * y);
+        x = x2 - y2 + cReal;
+    }
+
+    template <typename Pack, typename Value>
+    static void derivative(Value& dx, Value& dy, const Value& x, const Value& y,
+                           const Value& cReal, const Value& cImag) {
+        // conj(2 z dz)
+        MandelbrotFormula::derivative<Pack>(dx, dy, x, y, cReal, cImag);
+        dy = -dy;
+    }
+};
+
+// Derive the smooth count and distance estimate from the orbit at its escape.
+// (x, y) is z and (dx, dy) is dz/dc, or dz/dz0 for a Julia set, at the step the
+// bailout was crossed; (real, imag) is c.
+template <unsigned Features, typename Formula = MandelbrotFormula>
+inline EscapeResult finishEscape(double x, double y, double dx, double dy, double real, double imag,
+                                 int iterations, int maxIter) {
+    EscapeResult result;
+    result.iterations = iterations;
+    result.smooth = static_cast<float>(iterations);
+    result.distance = 0.0f;
+    if (iterations >= maxIter || !(Features & (KERNEL_SMOOTH | KERNEL_DISTANCE))) {
+        return result;
+    }
+
+    typedef KernelPack<double, 1> Scalar;
+    for (int k = 0; k < SMOOTH_EXTRA_ITERATIONS; k++) {
+        Formula::template derivative<Scalar>(dx, dy, x, y, real, imag);
+        if (!(Features & KERNEL_JULIA)) {
+            dx += 1;
+        }
+        Formula::template step<Scalar>(x, y, x * x, y * y, real, imag);
+    }
+
+    double modulus = std::sqrt(x * x + y * y);
+    if (Features & KERNEL_SMOOTH) {
+        double smooth = iterations + SMOOTH_EXTRA_ITERATIONS + 1 -
+                        std::log2(std::log2(modulus)) / std::log2(static_cast<double>(Formula::DEGREE));
+        // Clamped in float, to just below maxIter: a margin taken in double rounds away
+        // for caps from 2^15 up, and the pixel would be taken for one inside the set
+        result.smooth = std::min(static_cast<float>(std::max(smooth, 0.0)),
+                                 std::nextafter(static_cast<float>(maxIter), 0.0f));
+    }
+    if (Features & KERNEL_DISTANCE) {
+        result.distance = static_cast<float>(0.5 * modulus * std::log(modulus) / std::sqrt(dx * dx + dy * dy));
+    }
+    return result;
+}
+
+// Two points of an orbit closer than this are taken to be the same point of a cycle
+template <typename Real>
+constexpr double periodicityTolerance() {
+    return kernelEpsilon<Real>() * 16;
+}
+
+// Iterate Lanes points at once. Every lane keeps iterating so the loop carries no
+// blends; escaped lanes run off to infinity harmlessly, and the z and dz/dc each
+// lane had at its escape are latched on the side for finishEscape.
+// With KERNEL_JULIA the points are where z starts and (juliaReal, juliaImag) is c.
+template <typename Real, unsigned Features, int Lanes, typename Formula = MandelbrotFormula>
+inline void escapeTime(const typename KernelPack<Real, Lanes>::Value& real,
+                       const typename KernelPack<Real, Lanes>::Value& imag,
+                       const typename KernelPack<Real, Lanes>::Value& juliaReal,
+                       const typename KernelPack<Real, Lanes>::Value& juliaImag,
+                       int maxIter, EscapeResult* results) {
+    typedef KernelPack<Real, Lanes> Pack;
+    typedef typename Pack::Value Value;
+    typedef typename Pack::Mask Mask;
+
+    const bool julia = Features & KERNEL_JULIA;
+    const Value zero = Pack::broadcast(0);
+    const Value cReal = julia ? juliaReal : real;
+    const Value cImag = julia ? juliaImag : imag;
+    Value x = julia ? real : zero, y = julia ? imag : zero;
+    Value x2 = x * x, y2 = y * y;
+    Value dx = julia ? Pack::broadcast(1) : zero, dy = zero;
+    // A Julia point may start outside the bailout, so the latch starts at the first z
+    Value escapeX = x, escapeY = y, escapeDx = dx, escapeDy = dy;
+    typename Pack::Counter iterations = typename Pack::Counter();
+    Mask active = Pack::allLanes();
+    Mask cycled = Mask();
+
+    // Brent's cycle test: compare against a reference point refreshed at doubling intervals
+    const Value tolerance = Pack::broadcast(static_cast<Real>(periodicityTolerance<Real>() * periodicityTolerance<Real>()));
+    Value refX = zero, refY = zero;
+    int nextRefresh = 8;
+
+    for (int n = 0; n < maxIter; n++) {
+        active &= (x2 + y2 < Pack::broadcast(4));
+        if (!Pack::any(active)) {
+            break;
+        }
+        if (Features & KERNEL_DISTANCE) {
+            Formula::template derivative<Pack>(dx, dy, x, y, cReal, cImag);
+            if (!julia) {
+                dx = dx + Pack::broadcast(1);
+            }
+            escapeDx = Pack::select(active, dx, escapeDx);
+            escapeDy = Pack::select(active, dy, escapeDy);
+        }
+        Formula::template step<Pack>(x, y, x2, y2, cReal, cImag);
+        x2 = x * x;
+        y2 = y * y;
+        escapeX = Pack::select(active, x, escapeX);
+        escapeY = Pack::select(active, y, escapeY);
+        Pack::count(iterations, active);
+
+        if (Features & KERNEL_PERIODICITY) {
+            Value offX = x - refX;
+            Value offY = y - refY;
+            Mask repeated = active & (offX * offX + offY * offY < tolerance);
+            if (Pack::any(repeated)) {
+                cycled |= repeated;
+                Pack::clear(active, repeated);
+            }
+            if (n == nextRefresh) {
+                refX = x;
+                refY = y;
+                nextRefresh *= 2;
+            }
+        }
+    }
+
+    for (int lane = 0; lane < Lanes; lane++) {
+        int laneIterations = Pack::lane(cycled, lane) ? maxIter : Pack::lane(iterations, lane);
+        results[lane] = finishEscape<Features, Formula>(
+            static_cast<double>(Pack::lane(escapeX, lane)), static_cast<double>(Pack::lane(escapeY, lane)),
+            static_cast<double>(Pack::lane(escapeDx, lane)), static_cast<double>(Pack::lane(escapeDy, lane)),
+            static_cast<double>(Pack::lane(cReal, lane)), static_cast<double>(Pack::lane(cImag, lane)),
+            laneIterations, maxIter);
+    }
+}
+
+// The parameter plane, where every point is its own c
+template <typename Real, unsigned Features, int Lanes, typename Formula = MandelbrotFormula>
+inline void escapeTime(const typename KernelPack<Real, Lanes>::Value& real,
+                       const typename KernelPack<Real, Lanes>::Value& imag,
+                       int maxIter, EscapeResult* results) {
+    static_assert(!(Features & KERNEL_JULIA), "A Julia set needs its c");
+    escapeTime<Real, Features, Lanes, Formula>(real, imag, real, imag, maxIter, results);
+}
+
+// One row of points, real = realStart + i * realStep for i in [0, count).
+// Coordinates arrive in double-double so deep views keep every digit.
+typedef void (*RowKernel)(const DoubleDouble& realStart, double realStep, const DoubleDouble& imag,
+                          const JuliaParameter& julia, int count, int maxIter, EscapeResult* results);
+
+template <typename Real, unsigned Features, int Lanes, typename Formula = MandelbrotFormula>
+void escapeTimeRow(const DoubleDouble& realStart, double realStep, const DoubleDouble& imag,
+                   const JuliaParameter& julia, int count, int maxIter, EscapeResult* results) {
+    typedef KernelPack<Real, Lanes> Pack;
+    const typename Pack::Value imagPack = Pack::broadcast(toKernelReal<Real>(imag));
+    const typename Pack::Value juliaReal = Pack::broadcast(toKernelReal<Real>(julia.real));
+    const typename Pack::Value juliaImag = Pack::broadcast(toKernelReal<Real>(julia.imag));
+    EscapeResult packResults[Lanes];
+    for (int i = 0; i < count; i += Lanes) {
+        // The last pack of a row may hang over the end; its extra lanes are discarded
+        typename Pack::Value realPack;
+        for (int lane = 0; lane < Lanes; lane++) {
+            Pack::setLane(realPack, lane, toKernelReal<Real>(realStart + (i + lane) * realStep));
+        }
+        escapeTime<Real, Features, Lanes, Formula>(realPack, imagPack, juliaReal, juliaImag, maxIter, packResults);
+        std::copy(packResults, packResults + std::min(Lanes, count - i), results + i);
+    }
+}
+
+// Points anywhere in the plane rather than along a row, a pack at a time
+template <typename Real, unsigned Features, int Lanes, typename Formula = MandelbrotFormula>
+void escapeTimePoints(const DoubleDouble* real, const DoubleDouble* imag, int count, int maxIter,
+                      EscapeResult* results) {
+    typedef KernelPack<Real, Lanes> Pack;
+    EscapeResult packResults[Lanes];
+    for (int i = 0; i < count; i += Lanes) {
+        // The last pack repeats the final point in its extra lanes, which are discarded
+        typename Pack::Value realPack, imagPack;
+        for (int lane = 0; lane < Lanes; lane++) {
+            int point = std::min(i + lane, count - 1);
+            Pack::setLane(realPack, lane, toKernelReal<Real>(real[point]));
+            Pack::setLane(imagPack, lane, toKernelReal<Real>(imag[point]));
+        }
+        escapeTime<Real, Features, Lanes, Formula>(realPack, imagPack, maxIter, packResults);
+        std::copy(packResults, packResults + std::min(Lanes, count - i), results + i);
+    }
+}
+
+// Arithmetic the kernel can run in. Past double-double, views are rendered by
+// perturbation around a high-precision reference orbit (perturbation.h), which
+// has its own entry point rather than a RowKernel.
+enum class KernelPrecision {
+    Float,
+    Double,
+    DoubleDouble,
+    Perturbation,
+    Count
+};
+
+const int ROW_KERNEL_PRECISIONS = static_cast<int>(KernelPrecision::Perturbation);
+
+// Kernel outputs image renders use; the periodicity test only cuts work inside the set
+const unsigned IMAGE_KERNEL_FEATURES = KERNEL_SMOOTH | KERNEL_PERIODICITY;
+
+typedef void (*PointKernel)(const DoubleDouble* real, const DoubleDouble* imag, int count, int maxIter,
+                            EscapeResult* results);
+
+// One formula at every precision with every feature set, at the widest SIMD width
+// each precision allows, plus escapeTimePoints with the image features
+class KernelTable {
+public:
+    template <typename Formula>
+    static KernelTable of() {
+        KernelTable table;
+        auto features = std::make_integer_sequence<unsigned, KERNEL_FEATURE_COMBINATIONS>();
+        table.fill<Formula, float>(KernelPrecision::Float, features);
+        table.fill<Formula, double>(KernelPrecision::Double, features);
+        table.fill<Formula, DoubleDouble>(KernelPrecision::DoubleDouble, features);
+        return table;
+    }
+
+    RowKernel get(KernelPrecision precision, unsigned features) const {
+        return kernels[static_cast<int>(precision)][features & (KERNEL_FEATURE_COMBINATIONS - 1)];
+    }
+
+    PointKernel getPoints(KernelPrecision precision) const { return pointKernels[static_cast<int>(precision)]; }
+
+private:
+    template <typename Formula, typename Real, unsigned... Features>
+    void fill(KernelPrecision precision, std::integer_sequence<unsigned, Features...>) {
+        RowKernel* row = kernels[static_cast<int>(precision)];
+        ((row[Features] = &escapeTimeRow<Real, Features, nativeKernelLanes<Real>(), Formula>), ...);
+        pointKernels[static_cast<int>(precision)] =
+            &escapeTimePoints<Real, IMAGE_KERNEL_FEATURES, nativeKernelLanes<Real>(), Formula>;
+    }
+
+    RowKernel kernels[ROW_KERNEL_PRECISIONS][KERNEL_FEATURE_COMBINATIONS] = {};
+    PointKernel pointKernels[ROW_KERNEL_PRECISIONS] = {};
+};
+
+// Rounding error grows along the orbit, so a precision holds up at a pixel spacing
+// that is large against its rounding step (2 * epsilon, since |z| < 2 anywhere in
+// the view) times the iteration count. This factor is that margin, checked by
+// mandelrender verify-precision.
+const double PRECISION_HEADROOM = 128;
+
+// Lowest precision whose rounding stays invisible at this pixel spacing
+inline KernelPrecision choosePrecision(double pixelSpacing, int maxIterations) {
+    double orbitError = 2 * PRECISION_HEADROOM * maxIterations;
+    if (pixelSpacing >= std::numeric_limits<float>::epsilon() * orbitError) {
+        return KernelPrecision::Float;
+    }
+    if (pixelSpacing >= std::numeric_limits<double>::epsilon() * orbitError) {
+        return KernelPrecision::Double;
+    }
+    if (pixelSpacing >= kernelEpsilon<DoubleDouble>() * orbitError) {
+        return KernelPrecision::DoubleDouble;
+    }
+    return KernelPrecision::Perturbation;
+}
+
+inline const char* precisionName(KernelPrecision precision) {
+    switch (precision) {
+        case KernelPrecision::Float: return "float";
+        case KernelPrecision::Double: return "double";
+        case KernelPrecision::DoubleDouble: return "double-double";
+        case KernelPrecision::Perturbation: return "perturbation";
+        default: return "?";
+    }
+}
+
+// Formulas, by the index they were registered under. Tiles and frames carry the
+// index, and a render looks its kernels up here. The built-in ones come first,
+// in BuiltinFormula order; more can be added at run time. Entries never move
+// or change once added, so lookups take no lock.
+typedef int FormulaId;
+
+enum BuiltinFormula : FormulaId {
+    FORMULA_MANDELBROT,
+    FORMULA_MULTIBROT3,
+    FORMULA_MULTIBROT4,
+    FORMULA_BURNING_SHIP,
+    FORMULA_TRICORN,
+    BUILTIN_FORMULA_COUNT
+};
+
+struct FormulaEntry {
+    std::string name;        // What --formula takes
+    std::string expression;  // As shown to the user
+    bool perturbation;       // Whether deep views can be perturbed, which perturbation.h only does for z^2 + c
+    KernelTable kernels;
+};
+
+class FormulaRegistry {
+public:
+    static constexpr int MAX_FORMULAS = 64;
+
+    static FormulaRegistry& instance() {
+        static FormulaRegistry registry;
+        return registry;
+    }
+
+    // The new formula's id, or -1 once the registry is full
+    FormulaId add(const std::string& name, const std::string& expression, bool perturbation,
+                  const KernelTable& kernels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int id = count.load(std::memory_order_relaxed);
+        if (id == MAX_FORMULAS) {
+            return -1;
+        }
+        entries[id] = { name, expression, perturbation, kernels };
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    int size() const { return count.load(std::memory_order_acquire); }
+
+    const FormulaEntry& get(FormulaId id) const { return entries[id]; }
+
+    // The last formula added under a name, or -1
+    FormulaId find(const std::string& name) const {
+        for (FormulaId id = size() - 1; id >= 0; id--) {
+            if (entries[id].name == name) {
+                return id;
+            }
+        }
+        return -1;
+    }
+
+private:
+    FormulaRegistry() {
+        add("mandelbrot", "z^2 + c", true, KernelTable::of<MandelbrotFormula>());
+        add("multibrot3", "z^3 + c", false, KernelTable::of<MultibrotFormula<3>>());
+        add("multibrot4", "z^4 + c", false, KernelTable::of<MultibrotFormula<4>>());
+        add("burning-ship", "(abs(re(z)) + i abs(im(z)))^2 + c", false, KernelTable::of<BurningShipFormula>());
+        add("tricorn", "conj(z)^2 + c", false, KernelTable::of<TricornFormula>());
+    }
+
+    std::mutex mutex;  // Serializes adds
+    std::atomic<int> count{0};
+    FormulaEntry entries[MAX_FORMULAS];
+};
+
+// Formulas without a perturbation kernel go no deeper than double-double
+inline KernelPrecision formulaPrecision(KernelPrecision precision, FormulaId formula) {
+    return FormulaRegistry::instance().get(formula).perturbation ? precision
+                                                                 : std::min(precision, KernelPrecision::DoubleDouble);
+}
+
+// Pick the instantiation for a row-kernel precision, a KernelFeature bit set and a formula
+inline RowKernel selectKernel(KernelPrecision precision, unsigned features, FormulaId formula = FORMULA_MANDELBROT) {
+    return FormulaRegistry::instance().get(formula).kernels.get(precision, features);
+}
+
+// escapeTimePoints with the image features, for a row-kernel precision
+inline PointKernel selectPointKernel(KernelPrecision precision, FormulaId formula = FORMULA_MANDELBROT) {
+    return FormulaRegistry::instance().get(formula).kernels.getPoints(precision);
+}
+
+// Calculate the number of iterations for a point in the complex plane
+inline int calculateMandelbrot(double real, double imag, int maxIter) {
+    EscapeResult result;
+    escapeTime<double, 0, 1>(real, imag, maxIter, &result);
+    return result.iterations;
+}
+
+// Single-point kernel with the smooth count, and the distance estimate when asked for
+inline EscapeResult calculateMandelbrotDetailed(double real, double imag, int maxIter, bool wantDistance) {
+    EscapeResult result;
+    if (wantDistance) {
+        escapeTime<double, KERNEL_SMOOTH | KERNEL_DISTANCE, 1>(real, imag, maxIter, &result);
+    } else {
+        escapeTime<double, KERNEL_SMOOTH, 1>(real, imag, maxIter, &result);
+    }
+    return result;
+}
+
+// Map a value from one range to another
+inline double mapValue(double value, double inMin, double inMax, double outMin, double outMax) {
+    return outMin + (outMax - outMin) * ((value - inMin) / (inMax - inMin));
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Minimal on-screen text for diagnostics, so overlays need no font library.
+// Glyphs are 5x7 pixels, one byte per row with the leftmost pixel in bit 4,
+// covering ASCII ' ' to '_'; lowercase letters are drawn as uppercase.
+const Uint8 OVERLAY_FONT[64][7] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 },  // !
+    { 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00 },  // "
+    { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A },  // #
+    { 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 },  // $
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },  // %
+    { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D },  // &
+    { 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },  // (
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },  // )
+    { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 },  // *
+    { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },  // +
+    { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },  // ,
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },  // -
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },  // .
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },  // /
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },  // 0
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },  // 1
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },  // 2
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },  // 3
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },  // 4
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },  // 5
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },  // 6
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },  // 7
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },  // 8
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },  // 9
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },  // :
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 },  // ;
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 },  // <
+    { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },  // =
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 },  // >
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },  // ?
+    { 0x0E, 0x11, 0x17, 0x15, 0x17, 0x10, 0x0F },  // @
+    { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },  // A
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },  // B
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },  // C
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },  // D
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },  // E
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },  // F
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },  // G
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },  // H
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },  // I
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },  // J
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },  // K
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },  // L
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },  // M
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },  // N
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },  // O
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },  // P
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },  // Q
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },  // R
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },  // S
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },  // T
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },  // U
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },  // V
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },  // W
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },  // X
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },  // Y
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },  // Z
+    { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },  // [
+    { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 },  // backslash
+    { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E },  // ]
+    { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 },  // ^
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },  // _
+};
+
+const int OVERLAY_SCALE = 2;
+const int OVERLAY_CHAR_WIDTH = 6 * OVERLAY_SCALE;
+const int OVERLAY_LINE_HEIGHT = 9 * OVERLAY_SCALE;
+
+// Draw one line of text with the current draw colour
+inline void drawOverlayText(SDL_Renderer* renderer, int x, int y, const std::string& text) {
+    std::vector<SDL_Rect> rects;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c >= 'a' && c <= 'z') {
+            c = static_cast<char>(c - 'a' + 'A');
+        }
+        if (c < ' ' || c > '_') {
+            c = '?';
+        }
+        const Uint8* glyph = OVERLAY_FONT[c - ' '];
+        int left = x + static_cast<int>(i) * OVERLAY_CHAR_WIDTH;
+        for (int row = 0; row < 7; row++) {
+            for (int col = 0; col < 5; col++) {
+                if (glyph[row] & (0x10 >> col)) {
+                    rects.push_back({ left + col * OVERLAY_SCALE, y + row * OVERLAY_SCALE,
+                                      OVERLAY_SCALE, OVERLAY_SCALE });
+                }
+            }
+        }
+    }
+    if (!rects.empty()) {
+        SDL_RenderFillRects(renderer, rects.data(), static_cast<int>(rects.size()));
+    }
+}
+
+// Draw lines of text on a translucent panel; returns the panel height
+inline int drawOverlayPanel(SDL_Renderer* renderer, int x, int y, const std::vector<std::string>& lines) {
+    size_t longest = 0;
+    for (const std::string& line : lines) {
+        longest = std::max(longest, line.size());
+    }
+    const int padding = 6;
+    SDL_Rect panel = { x, y, static_cast<int>(longest) * OVERLAY_CHAR_WIDTH + 2 * padding,
+                       static_cast<int>(lines.size()) * OVERLAY_LINE_HEIGHT + 2 * padding };
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 170);
+    SDL_RenderFillRect(renderer, &panel);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    for (size_t i = 0; i < lines.size(); i++) {
+        drawOverlayText(renderer, x + padding, y + padding + static_cast<int>(i) * OVERLAY_LINE_HEIGHT, lines[i]);
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    return panel.h;
+}
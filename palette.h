@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Colour of a pixel from its smooth iteration count, packed as the bytes
+// R, G, B, A in memory order (ABGR8888 on little-endian machines)
+inline uint32_t colorForIterations(float smooth, int maxIterations) {
+    uint8_t r, g, b;
+    if (smooth >= maxIterations) {
+        // Inside the set - black
+        r = g = b = 0;
+    } else {
+        // Outside the set - hue cycles every 64 iterations, blended across bands
+        double hue = std::fmod(static_cast<double>(smooth), 64.0) / 64.0;
+        double saturation = 0.8;
+        double value = 1.0;
+
+        // HSV to RGB conversion
+        double h = hue * 6.0;
+        int i = static_cast<int>(h);
+        double f = h - i;
+        double p = value * (1.0 - saturation);
+        double q = value * (1.0 - saturation * f);
+        double t = value * (1.0 - saturation * (1.0 - f));
+
+        switch (i % 6) {
+            case 0: r = value * 255; g = t * 255; b = p * 255; break;
+            case 1: r = q * 255; g = value * 255; b = p * 255; break;
+            case 2: r = p * 255; g = value * 255; b = t * 255; break;
+            case 3: r = p * 255; g = q * 255; b = value * 255; break;
+            case 4: r = t * 255; g = p * 255; b = value * 255; break;
+            default: r = value * 255; g = p * 255; b = q * 255; break;
+        }
+    }
+    return static_cast<uint32_t>(r) | (g << 8) | (b << 16) | (255u << 24);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "fixed_point.h"
+#include "mandelbrot.h"
+
+// Perturbation rendering for views deeper than double-double can resolve.
+//
+// One reference point, normally the view center, is iterated in FixedPoint at
+// whatever precision the view needs, and its orbit Z is kept in doubles. Every pixel is
+// then the reference plus a small offset dc, and only the offset of its orbit,
+// d = z - Z, is iterated, in plain doubles:
+//
+//     d' = 2 Z d + d^2 + dc
+//
+// While d is below the double range it is carried as w * 2^e, and the exponent
+// moves with it. Whenever the pixel's orbit comes closer to 0 than d itself, or
+// the reference orbit runs out, the pixel rebases onto the start of the
+// reference orbit (d = z), which keeps d small and the result free of glitches.
+
+// The reference point's orbit, Z[0] = 0 up to its escape or maxIter
+struct ReferenceOrbit {
+    FixedPoint pointReal;  // The reference point c
+    FixedPoint pointImag;
+    std::vector<double> real;
+    std::vector<double> imag;
+    int escapeIteration;  // maxIter when the reference never escaped
+
+    // Index of the last usable point
+    int last() const { return static_cast<int>(real.size()) - 1; }
+};
+
+inline ReferenceOrbit computeReferenceOrbit(const FixedPoint& centerReal, const FixedPoint& centerImag, int maxIter) {
+    ReferenceOrbit orbit;
+    orbit.pointReal = centerReal;
+    orbit.pointImag = centerImag;
+    orbit.real.reserve(maxIter + 1);
+    orbit.imag.reserve(maxIter + 1);
+    orbit.escapeIteration = maxIter;
+    int limbs = std::max(centerReal.size(), centerImag.size());
+    const FixedPoint bailout = FixedPoint::fromDouble(4.0, limbs);
+    FixedPoint x(limbs), y(limbs);
+    for (int n = 0; ; n++) {
+        orbit.real.push_back(x.toDouble());
+        orbit.imag.push_back(y.toDouble());
+        FixedPoint x2 = x * x;
+        FixedPoint y2 = y * y;
+        // Exactly, since a pixel's orbit is compared with the same bound
+        if (!(x2 + y2 < bailout)) {
+            orbit.escapeIteration = n;
+            break;
+        }
+        if (n == maxIter) {
+            break;
+        }
+        y = x * y;
+        y = y + y + centerImag;
+        x = x2 - y2 + centerReal;
+    }
+    return orbit;
+}
+
+// When the view center escapes early, the reference is the longest-lived point
+// of a grid this many pixels across
+const int REFERENCE_CANDIDATE_GRID = 5;
+
+// While the offset's exponent is below this, d is carried as w * 2^e
+const long long PERTURBATION_RESCALE_EXPONENT = -900;
+
+// Renormalize w back towards 1 once it grows past this
+const double PERTURBATION_RESCALE_LIMIT = 0x1p64;
+
+// One pixel at dc = (uReal, uImag) * 2^cExponent from the reference.
+// Only the smooth count is produced: dz/dc overflows at these depths, and a
+// cycle test on double-precision z would mistake slow escapes for cycles.
+inline EscapeResult perturbationPoint(const ReferenceOrbit& orbit, double uReal, double uImag, long long cExponent,
+                                      int maxIter) {
+    const double* refReal = orbit.real.data();
+    const double* refImag = orbit.imag.data();
+    const int last = orbit.last();
+    int n = 0;
+    int iterations = 0;
+    double x = 0.0, y = 0.0;  // z at the escape
+    bool escaped = false;
+
+    // Rescaled phase: d = w * 2^e, dc = u * 2^cExponent
+    double wr = 0.0, wi = 0.0;
+    long long e = cExponent;
+    double deltaScale = FloatExp(1.0, e).toDouble();
+    double cScale = 1.0;
+    bool rescaled = e < PERTURBATION_RESCALE_EXPONENT;
+    while (rescaled && iterations < maxIter) {
+        double zr = refReal[n], zi = refImag[n];
+        double nextWr = 2 * (zr * wr - zi * wi) + (wr * wr - wi * wi) * deltaScale + uReal * cScale;
+        wi = 2 * (zr * wi + zi * wr) + 2 * wr * wi * deltaScale + uImag * cScale;
+        wr = nextWr;
+        n++;
+        iterations++;
+
+        // d is far below the resolution of Z here, so z is Z as far as doubles go
+        zr = refReal[n];
+        zi = refImag[n];
+        if (zr * zr + zi * zi >= 4.0) {
+            x = zr;
+            y = zi;
+            escaped = true;
+            break;
+        }
+        double zMagnitude = std::fabs(zr) + std::fabs(zi);
+        double wMagnitude = std::fabs(wr) + std::fabs(wi);
+        if (zMagnitude < wMagnitude * deltaScale || zMagnitude == 0.0) {
+            // The orbit passed closer to 0 than its offset: rebase, d = Z + d
+            wr += std::ldexp(zr, static_cast<int>(-e));
+            wi += std::ldexp(zi, static_cast<int>(-e));
+            n = 0;
+        } else if (n == last) {
+            // Out of reference orbit: d = Z + d, which doubles hold outright
+            wr = zr;
+            wi = zi;
+            e = 0;
+            n = 0;
+            rescaled = false;
+            break;
+        }
+        if (wMagnitude > PERTURBATION_RESCALE_LIMIT) {
+            int shift = std::ilogb(wMagnitude);
+            wr = std::ldexp(wr, -shift);
+            wi = std::ldexp(wi, -shift);
+            e += shift;
+            deltaScale = FloatExp(1.0, e).toDouble();
+            cScale = FloatExp(1.0, cExponent - e).toDouble();
+            rescaled = e < PERTURBATION_RESCALE_EXPONENT;
+        }
+    }
+
+    if (!escaped) {
+        // Plain phase: d and dc are ordinary doubles
+        double dr = FloatExp(wr, e).toDouble();
+        double di = FloatExp(wi, e).toDouble();
+        double cr = FloatExp(uReal, cExponent).toDouble();
+        double ci = FloatExp(uImag, cExponent).toDouble();
+        while (iterations < maxIter) {
+            double zr = refReal[n], zi = refImag[n];
+            // d' = (2 Z + d) d + dc
+            double tr = 2 * zr + dr;
+            double ti = 2 * zi + di;
+            double nextDr = tr * dr - ti * di + cr;
+            di = tr * di + ti * dr + ci;
+            dr = nextDr;
+            n++;
+            iterations++;
+
+            zr = refReal[n] + dr;
+            zi = refImag[n] + di;
+            double zMagnitude = zr * zr + zi * zi;
+            if (zMagnitude >= 4.0) {
+                x = zr;
+                y = zi;
+                escaped = true;
+                break;
+            }
+            if (zMagnitude < dr * dr + di * di || n == last) {
+                dr = zr;
+                di = zi;
+                n = 0;
+            }
+        }
+    }
+
+    // The extra iterations of the smooth count only need c to double precision
+    return finishEscape<KERNEL_SMOOTH>(x, y, 0.0, 0.0, refReal[last > 0 ? 1 : 0], refImag[last > 0 ? 1 : 0],
+                                       escaped ? iterations : maxIter, maxIter);
+}
+
+// Pixels (x0 + i) * step from the reference along a row, for i in [0, count), at
+// imagOffset * step from it vertically. step is the horizontal pixel spacing.
+inline void perturbationRow(const ReferenceOrbit& orbit, const FloatExp& step, double x0, double imagOffset,
+                            int count, int maxIter, EscapeResult* results) {
+    for (int i = 0; i < count; i++) {
+        results[i] = perturbationPoint(orbit, (x0 + i) * step.mantissa, imagOffset * step.mantissa, step.exponent,
+                                       maxIter);
+    }
+}
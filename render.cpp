@@ -0,0 +1,1387 @@
+// Headless renderer: produces Mandelbrot output without opening a window
+//
+//   mandelrender audio <points.txt|-> <out.wav|-> [options]
+//   mandelrender animate <keyframes.txt|-> <frame%05d.ppm|-> [options]
+//   mandelrender verify-precision [--threads n]
+//   mandelrender verify-formulas [--threads n]
+//   mandelrender verify-store
+//
+// audio: the input holds one "real imag" pair per line ('#' starts a comment).
+// Each point becomes a note from the same synthesis the interactive app plays
+// on click; with --path-steps the points are treated as a polyline instead and
+// notes are sampled along it.
+//
+// animate: renders a zoom through keyframes, one "time real imag width max-iter"
+// per line, into numbered PPM images or, for -, raw RGB frames on standard
+// output for an encoder to read. --audio adds a WAV of the same length, with a
+// note for the point at the center of the view every --note-interval seconds.
+// --exp-map renders a zoom into one center once, as an exponential map, and
+// resamples every frame from it. --reuse renders key images at up to
+// --reuse-scale times the frame size and resamples the frames around each one
+// from it, as long as it has --reuse-quality pixels across each frame pixel.
+//
+// verify-precision: renders views at the pixel spacings where the kernel
+// precision switches and checks them against a finer reference, then checks
+// perturbation at spacings down to 1e-330 against plain fixed-point orbits,
+// and that views zoomed far out take a bounded number of tiles and skip the
+// zoom-out preview. Exits non-zero if any switch would be visible or a wide
+// view takes too many tiles.
+//
+// verify-formulas: compiles the expression of every built-in formula as a typed
+// formula and renders it in float, double and double-double against the
+// built-in kernels. Exits non-zero if the smooth count or the distance estimate
+// differs visibly, or a formula cannot be compiled.
+//
+// verify-store: round-trips tiles through the tile store's compression, then
+// checks that a store reopened after a torn append or with a flipped byte keeps
+// exactly its intact records, including those after a damaged one. Exits
+// non-zero if a count comes back more than one fixed-point step off, a damaged
+// record is indexed or an intact one is lost.
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "exp_map.h"
+#include "fixed_point.h"
+#include "formula_jit.h"
+#include "mandelbrot.h"
+#include "palette.h"
+#include "sound.h"
+#include "tile_cache.h"
+#include "tile_render.h"
+#include "view.h"
+#include "wav_writer.h"
+
+// Multithreading settings
+const int NUM_THREADS = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 4;
+
+// Audio is rendered in chunks of this many frames, one chunk per job
+const int AUDIO_CHUNK_FRAMES = 16384;
+
+struct PlanePoint {
+    double real;
+    double imag;
+};
+
+// A note placed on the output timeline
+struct ScheduledNote {
+    NoteParams params;
+    long long start;      // First sample of the note
+    long long end;        // One past the last sample that is non-silent
+    long long fadeStart;  // Sample where the crossfade into the next note begins
+    int fadeLength;
+};
+
+struct AudioRenderOptions {
+    double interval = 1.0;    // Seconds between note onsets
+    double crossfade = 0.02;  // Seconds over which a note yields to the next one
+    int maxIterations = 100;
+    int sampleRate = DEFAULT_SAMPLE_RATE;
+    int pathSteps = 0;        // Notes per path segment; 0 plays the points as given
+    int threads = NUM_THREADS;
+};
+
+static bool readPoints(std::istream& in, std::vector<PlanePoint>& points) {
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        PlanePoint p;
+        if (!(fields >> p.real)) {
+            continue;  // Blank or comment-only line
+        }
+        if (!(fields >> p.imag)) {
+            std::cerr << "Line " << lineNumber << ": expected \"real imag\"" << std::endl;
+            return false;
+        }
+        points.push_back(p);
+    }
+    return true;
+}
+
+// Sample a polyline through the points with `steps` notes per segment
+static std::vector<PlanePoint> samplePath(const std::vector<PlanePoint>& points, int steps) {
+    std::vector<PlanePoint> path;
+    for (size_t i = 0; i + 1 < points.size(); i++) {
+        for (int s = 0; s < steps; s++) {
+            double t = static_cast<double>(s) / steps;
+            path.push_back({ points[i].real + (points[i + 1].real - points[i].real) * t,
+                             points[i].imag + (points[i + 1].imag - points[i].imag) * t });
+        }
+    }
+    if (!points.empty()) {
+        path.push_back(points.back());
+    }
+    return path;
+}
+
+// Lay the notes out on the timeline, one every interval. A note that is still
+// sounding when the next one starts fades out over the crossfade window, just
+// like a new click replaces the playing note in the interactive app but
+// without the hard cut.
+static std::vector<ScheduledNote> layoutNotes(const std::vector<NoteParams>& params,
+                                              const AudioRenderOptions& options) {
+    std::vector<ScheduledNote> notes(params.size());
+    long long intervalSamples = static_cast<long long>(options.interval * options.sampleRate);
+    int fadeLength = std::max(1, static_cast<int>(options.crossfade * options.sampleRate));
+
+    for (size_t i = 0; i < notes.size(); i++) {
+        ScheduledNote& note = notes[i];
+        note.params = params[i];
+        note.start = static_cast<long long>(i) * intervalSamples;
+        note.end = note.start + noteSampleCount(note.params);
+        note.fadeStart = note.end;
+        note.fadeLength = fadeLength;
+        if (i + 1 < notes.size()) {
+            long long nextStart = note.start + intervalSamples;
+            if (nextStart < note.end) {
+                note.fadeStart = nextStart;
+                note.end = std::min(note.end, nextStart + fadeLength);
+            }
+        }
+    }
+    return notes;
+}
+
+static std::vector<ScheduledNote> scheduleNotes(const std::vector<PlanePoint>& points,
+                                                const AudioRenderOptions& options) {
+    std::vector<NoteParams> params(points.size());
+
+    // Iteration counts are independent per point, so compute them in parallel
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; t++) {
+        threads.push_back(std::thread([&]() {
+            for (size_t i = next++; i < points.size(); i = next++) {
+                double iterations = calculateMandelbrotDetailed(points[i].real, points[i].imag,
+                                                                options.maxIterations, false).smooth;
+                params[i] = makeNoteParams(iterations, points[i].real, points[i].imag,
+                                           options.maxIterations, options.sampleRate);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return layoutNotes(params, options);
+}
+
+// Render frames [chunkStart, chunkStart + count) of the timeline into out.
+// Every sample depends only on its absolute position, so chunks rendered on
+// different threads line up exactly at their boundaries.
+static void renderAudioChunk(const std::vector<ScheduledNote>& notes, long long chunkStart, int count,
+                             std::vector<float>& mix, std::vector<float>& scratch,
+                             const OutputFormat& format, int16_t* out) {
+    long long chunkEnd = chunkStart + count;
+    mix.assign(static_cast<size_t>(count) * SYNTH_CHANNELS, 0.0f);
+
+    // Notes are sorted by start; only those overlapping the chunk contribute
+    auto first = std::lower_bound(notes.begin(), notes.end(), chunkStart,
+        [](const ScheduledNote& note, long long pos) { return note.start + noteSampleCount(note.params) <= pos; });
+    for (auto it = first; it != notes.end() && it->start < chunkEnd; ++it) {
+        long long from = std::max(chunkStart, it->start);
+        long long to = std::min(chunkEnd, it->end);
+        if (from >= to) {
+            continue;
+        }
+        int length = static_cast<int>(to - from);
+        scratch.assign(static_cast<size_t>(length) * SYNTH_CHANNELS, 0.0f);
+        renderNoteSamples(it->params, static_cast<int>(from - it->start), length, scratch.data());
+
+        float* dst = mix.data() + (from - chunkStart) * SYNTH_CHANNELS;
+        for (int n = 0; n < length; n++) {
+            long long pos = from + n;
+            float gain = 1.0f;
+            if (pos >= it->fadeStart) {
+                gain = 1.0f - static_cast<float>(pos - it->fadeStart) / it->fadeLength;
+            }
+            dst[2 * n] += scratch[2 * n] * gain;
+            dst[2 * n + 1] += scratch[2 * n + 1] * gain;
+        }
+    }
+
+    convertStereoFrames(mix.data(), count, format, reinterpret_cast<uint8_t*>(out));
+}
+
+// minimumSamples pads the output with silence, to line it up with something longer than its notes
+static bool renderAudio(const std::vector<ScheduledNote>& notes, const OutputFormat& format,
+                        WavWriter& wav, int threadCount, long long minimumSamples = 0) {
+    long long totalSamples = minimumSamples;
+    for (const ScheduledNote& note : notes) {
+        totalSamples = std::max(totalSamples, note.end);
+    }
+
+    // Render a batch of chunks in parallel, then stream them out in order,
+    // so memory stays bounded no matter how long the output is
+    int batchChunks = threadCount * 4;
+    const size_t chunkSamples = static_cast<size_t>(AUDIO_CHUNK_FRAMES) * format.channels;
+    std::vector<int16_t> batch(batchChunks * chunkSamples);
+
+    for (long long batchStart = 0; batchStart < totalSamples;
+         batchStart += static_cast<long long>(batchChunks) * AUDIO_CHUNK_FRAMES) {
+        std::atomic<int> nextChunk(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([&]() {
+                std::vector<float> mix, scratch;
+                for (int c = nextChunk++; c < batchChunks; c = nextChunk++) {
+                    long long chunkStart = batchStart + static_cast<long long>(c) * AUDIO_CHUNK_FRAMES;
+                    if (chunkStart >= totalSamples) {
+                        break;
+                    }
+                    int count = static_cast<int>(std::min<long long>(AUDIO_CHUNK_FRAMES, totalSamples - chunkStart));
+                    renderAudioChunk(notes, chunkStart, count, mix, scratch, format,
+                                     batch.data() + c * chunkSamples);
+                }
+            }));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        size_t batchFrames = static_cast<size_t>(std::min<long long>(batch.size() / format.channels,
+                                                                     totalSamples - batchStart));
+        if (!wav.write(batch.data(), batchFrames * format.channels)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int runAudio(int argc, char* args[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: mandelrender audio <points.txt|-> <out.wav|-> [--interval s] [--crossfade s]"
+                     " [--max-iter n] [--path-steps n] [--rate hz] [--threads n]" << std::endl;
+        return 1;
+    }
+    const char* inputPath = args[0];
+    const char* outputPath = args[1];
+
+    AudioRenderOptions options;
+    for (int i = 2; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(args[i], "--interval") && hasValue) {
+            options.interval = atof(args[++i]);
+        } else if (!strcmp(args[i], "--crossfade") && hasValue) {
+            options.crossfade = atof(args[++i]);
+        } else if (!strcmp(args[i], "--max-iter") && hasValue) {
+            options.maxIterations = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--path-steps") && hasValue) {
+            options.pathSteps = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--rate") && hasValue) {
+            options.sampleRate = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--threads") && hasValue) {
+            options.threads = std::max(1, atoi(args[++i]));
+        } else {
+            std::cerr << "Unknown option: " << args[i] << std::endl;
+            return 1;
+        }
+    }
+    if (options.interval <= 0.0 || options.maxIterations <= 0 || options.sampleRate <= 0) {
+        std::cerr << "--interval, --max-iter and --rate must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<PlanePoint> points;
+    bool ok;
+    if (!strcmp(inputPath, "-")) {
+        ok = readPoints(std::cin, points);
+    } else {
+        std::ifstream file(inputPath);
+        if (!file) {
+            std::cerr << "Could not open " << inputPath << std::endl;
+            return 1;
+        }
+        ok = readPoints(file, points);
+    }
+    if (!ok) {
+        return 1;
+    }
+    if (points.empty()) {
+        std::cerr << "No points in " << inputPath << std::endl;
+        return 1;
+    }
+    if (options.pathSteps > 0) {
+        points = samplePath(points, options.pathSteps);
+    }
+
+    std::vector<ScheduledNote> notes = scheduleNotes(points, options);
+
+    // WAV output is 16-bit stereo at the requested rate
+    OutputFormat format = { options.sampleRate, SYNTH_CHANNELS, SampleFormat::Int16 };
+    WavWriter wav;
+    if (!wav.open(outputPath, format.sampleRate, format.channels)) {
+        std::cerr << "Could not open " << outputPath << " for writing" << std::endl;
+        return 1;
+    }
+    if (!renderAudio(notes, format, wav, options.threads) || !wav.close()) {
+        std::cerr << "Failed writing " << outputPath << std::endl;
+        return 1;
+    }
+
+    std::cerr << "Rendered " << notes.size() << " notes to " << outputPath << std::endl;
+    return 0;
+}
+
+// Run a frame over every pixel of a width x height grid, rows shared out between threads
+static std::vector<EscapeResult> renderEscapeImage(const KernelFrame& frame, int width, int height, int threadCount) {
+    std::vector<EscapeResult> image(static_cast<size_t>(width) * height);
+    std::atomic<int> nextRow(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int y = nextRow++; y < height; y = nextRow++) {
+                frame.renderRow(y, 0, width, image.data() + static_cast<size_t>(y) * width);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return image;
+}
+
+// Where the animation is at one moment
+struct Keyframe {
+    double time;  // Seconds
+    View view;
+    int maxIterations;
+};
+
+// The decimal fields of a keyframe line, kept as text until the deepest zoom
+// tells how many limbs the centers need
+struct KeyframeText {
+    double time;
+    std::string real;
+    std::string imag;
+    FloatExp width;
+    int maxIterations;
+};
+
+struct AnimationOptions {
+    int width = 640;
+    int height = 480;
+    double fps = 30.0;
+    bool expMap = false;       // Resample frames from an exponential map instead of rendering each
+    bool reuse = false;        // Resample frames from shared key images instead of rendering each
+    double reuseScale = 2.0;   // Largest key image, in frame sizes each way
+    double reuseQuality = 1.0;  // Fewest key image pixels across each frame pixel
+    std::string audioPath;     // Companion WAV; empty for none
+    AudioRenderOptions audio;  // interval is the time between notes
+    int threads = NUM_THREADS;
+};
+
+// Frames rendered per batch, for each thread; a batch is written out in order
+const int ANIMATION_BATCH_FRAMES = 2;
+
+// Default seconds between the notes of the companion audio
+const double ANIMATION_NOTE_INTERVAL = 0.5;
+
+// 2^exponent as a FloatExp, for exponents past the range of doubles
+static FloatExp exp2FloatExp(double exponent) {
+    double whole = std::floor(exponent);
+    return FloatExp(std::exp2(exponent - whole), static_cast<long long>(whole));
+}
+
+// A decimal such as "2.5e-400", which would underflow as a double
+static bool parseFloatExp(const std::string& text, FloatExp& value) {
+    size_t e = text.find_first_of("eE");
+    char* end = nullptr;
+    double mantissa = strtod(text.substr(0, e).c_str(), &end);
+    if (*end != '\0') {
+        return false;
+    }
+    long exponent = 0;
+    if (e != std::string::npos) {
+        exponent = strtol(text.c_str() + e + 1, &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    value = FloatExp(mantissa) * exp2FloatExp(exponent * std::log2(10.0));
+    return true;
+}
+
+static bool isDecimal(const std::string& text) {
+    size_t first = !text.empty() && text[0] == '-' ? 1 : 0;
+    return text.size() > first && text.find_first_not_of("0123456789.", first) == std::string::npos &&
+           std::count(text.begin(), text.end(), '.') <= 1;
+}
+
+// One "time real imag width max-iter" line per keyframe, in increasing time.
+// The center is a plain decimal of any length; the width may take an exponent.
+static bool readKeyframes(std::istream& in, std::vector<Keyframe>& keyframes) {
+    std::vector<KeyframeText> lines;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        KeyframeText key;
+        std::string width;
+        if (!(fields >> key.time)) {
+            continue;  // Blank or comment-only line
+        }
+        if (!(fields >> key.real >> key.imag >> width >> key.maxIterations) || !isDecimal(key.real) ||
+            !isDecimal(key.imag) || !parseFloatExp(width, key.width) || key.width.mantissa <= 0.0 ||
+            key.maxIterations <= 0) {
+            std::cerr << "Line " << lineNumber << ": expected \"time real imag width max-iter\"" << std::endl;
+            return false;
+        }
+        if (!lines.empty() && key.time <= lines.back().time) {
+            std::cerr << "Line " << lineNumber << ": keyframe times must increase" << std::endl;
+            return false;
+        }
+        lines.push_back(key);
+    }
+
+    // Every center gets the limbs of the deepest one, so the offsets between them are exact
+    int limbs = FixedPoint::MIN_LIMBS;
+    for (const KeyframeText& key : lines) {
+        limbs = std::max(limbs, limbsForStep(key.width, VIEW_GUARD_BITS));
+    }
+    for (const KeyframeText& key : lines) {
+        Keyframe keyframe;
+        keyframe.time = key.time;
+        keyframe.view.width = key.width;
+        keyframe.view.centerReal = FixedPoint::fromDecimal(key.real, limbs);
+        keyframe.view.centerImag = FixedPoint::fromDecimal(key.imag, limbs);
+        keyframe.maxIterations = key.maxIterations;
+        keyframes.push_back(keyframe);
+    }
+    return true;
+}
+
+// 2^exponent - 1, which keeps its relative precision as the exponent nears 0
+static FloatExp exp2Minus1(double exponent) {
+    if (exponent < 64.0) {
+        return FloatExp(std::expm1(exponent * std::log(2.0)));
+    }
+    return exp2FloatExp(exponent);  // The 1 is below the last bit
+}
+
+// The view a fraction s of the way from keyframe a to keyframe b.
+//
+// The zoom runs at a constant rate, so the log of the width moves linearly. The
+// center moves in step with the width, as far along as the width has come, which
+// keeps the deeper keyframe's center still on screen as the view closes in on it
+// and pans at a steady pace where the width stays put. The offset is measured
+// from the deeper center and scaled down with the width, so it is exact to well
+// under a pixel at any depth.
+static View interpolateView(const Keyframe& a, const Keyframe& b, double s, int screenWidth, int screenHeight) {
+    View view;
+    double widthBits = (1.0 - s) * a.view.width.log2() + s * b.view.width.log2();
+    view.width = exp2FloatExp(widthBits);
+    view.height = view.width * (static_cast<double>(screenHeight) / screenWidth);
+
+    bool aDeeper = a.view.width.log2() <= b.view.width.log2();
+    const View& deep = aDeeper ? a.view : b.view;
+    const View& wide = aDeeper ? b.view : a.view;
+    double fromDeep = aDeeper ? s : 1.0 - s;
+    double zoomBits = wide.width.log2() - deep.width.log2();
+
+    // How far the width has come from the deeper keyframe, in [0, 1]
+    FloatExp along = zoomBits < 1e-9 ? FloatExp(fromDeep) : exp2Minus1(fromDeep * zoomBits) / exp2Minus1(zoomBits);
+    int limbs = deep.centerReal.size();
+    FloatExp realOffset = (wide.centerReal - deep.centerReal).toFloatExp() * along;
+    FloatExp imagOffset = (wide.centerImag - deep.centerImag).toFloatExp() * along;
+    view.centerReal = deep.centerReal + FixedPoint::fromFloatExp(realOffset, limbs);
+    view.centerImag = deep.centerImag + FixedPoint::fromFloatExp(imagOffset, limbs);
+
+    // Shallower frames drop the limbs only the deepest one needs
+    view.centerReal = view.centerReal.withLimbs(view.limbs());
+    view.centerImag = view.centerImag.withLimbs(view.limbs());
+    return view;
+}
+
+// The view and iteration cap at a time; held at the first and last keyframes outside their span
+static Keyframe animationAt(const std::vector<Keyframe>& keyframes, double time, int screenWidth, int screenHeight) {
+    size_t next = 0;
+    while (next < keyframes.size() && keyframes[next].time <= time) {
+        next++;
+    }
+    const Keyframe& a = keyframes[next == 0 ? 0 : next - 1];
+    const Keyframe& b = keyframes[std::min(next, keyframes.size() - 1)];
+    double s = &a == &b ? 0.0 : (time - a.time) / (b.time - a.time);
+
+    Keyframe frame;
+    frame.time = time;
+    frame.view = interpolateView(a, b, s, screenWidth, screenHeight);
+    // The cap grows geometrically too, as deeper views need more iterations
+    frame.maxIterations = static_cast<int>(std::lround(
+        std::exp((1.0 - s) * std::log(a.maxIterations) + s * std::log(b.maxIterations))));
+    return frame;
+}
+
+// One frame as packed RGB rows, on the calling thread
+static void renderAnimationFrame(const Keyframe& frame, int width, int height, std::vector<EscapeResult>& row,
+                                 uint8_t* rgb) {
+    KernelFrame kernel(frame.view, width, height, frame.maxIterations, IMAGE_KERNEL_FEATURES);
+    row.resize(width);
+    for (int y = 0; y < height; y++) {
+        kernel.renderRow(y, 0, width, row.data());
+        for (int x = 0; x < width; x++) {
+            uint32_t color = colorForIterations(row[x].smooth, frame.maxIterations);
+            *rgb++ = color & 0xFF;
+            *rgb++ = (color >> 8) & 0xFF;
+            *rgb++ = (color >> 16) & 0xFF;
+        }
+    }
+}
+
+// The iteration cap of frames this wide, for exponential-map rows at the radius of
+// their pixels beside the center. Where the zoom passes a width more than once,
+// the highest of the caps there.
+static int iterationsForWidth(const std::vector<Keyframe>& keyframes, const FloatExp& width) {
+    double bits = width.log2();
+    int iterations = 0;
+    for (size_t i = 0; i + 1 < keyframes.size(); i++) {
+        double aBits = keyframes[i].view.width.log2();
+        double bBits = keyframes[i + 1].view.width.log2();
+        if (bits < std::min(aBits, bBits) || bits > std::max(aBits, bBits)) {
+            continue;
+        }
+        double s = aBits == bBits ? 0.0 : (bits - aBits) / (bBits - aBits);
+        iterations = std::max(iterations, static_cast<int>(std::lround(std::exp(
+            (1.0 - s) * std::log(keyframes[i].maxIterations) + s * std::log(keyframes[i + 1].maxIterations)))));
+    }
+    if (iterations > 0) {
+        return iterations;
+    }
+    // Outside every keyframe's width: the cap of the nearest extreme
+    auto widest = std::max_element(keyframes.begin(), keyframes.end(),
+        [](const Keyframe& a, const Keyframe& b) { return a.view.width.log2() < b.view.width.log2(); });
+    auto deepest = std::min_element(keyframes.begin(), keyframes.end(),
+        [](const Keyframe& a, const Keyframe& b) { return a.view.width.log2() < b.view.width.log2(); });
+    return bits > widest->view.width.log2() ? widest->maxIterations : deepest->maxIterations;
+}
+
+// The exponential map covering every frame of a zoom, or null when the
+// keyframes move the center, which a single map cannot follow
+static std::unique_ptr<ExpMap> makeExpMap(const std::vector<Keyframe>& keyframes, const AnimationOptions& options) {
+    FloatExp widest = keyframes[0].view.width;
+    FloatExp deepest = widest;
+    for (const Keyframe& keyframe : keyframes) {
+        if (keyframe.view.centerReal != keyframes[0].view.centerReal ||
+            keyframe.view.centerImag != keyframes[0].view.centerImag) {
+            return nullptr;
+        }
+        widest = keyframe.view.width.log2() > widest.log2() ? keyframe.view.width : widest;
+        deepest = keyframe.view.width.log2() < deepest.log2() ? keyframe.view.width : deepest;
+    }
+    double halfDiagonal = std::hypot(options.width / 2.0, options.height / 2.0);
+    int columns = static_cast<int>(std::ceil(2 * M_PI * halfDiagonal * EXP_MAP_OVERSAMPLING));
+    return std::make_unique<ExpMap>(keyframes[0].view.centerReal, keyframes[0].view.centerImag,
+        widest / options.width * halfDiagonal, deepest / options.width, columns,
+        [&](const FloatExp& radius) { return iterationsForWidth(keyframes, radius * options.width); });
+}
+
+// A render that the frames around it resample instead of rendering their own
+struct KeyImage {
+    View view;
+    int width;
+    int height;
+    int maxIterations;
+    std::vector<uint32_t> colors;  // Coloured, so resampling never blends across a palette wrap
+    int frames;  // Consecutive frames it covers
+};
+
+// The key image for frames from `first` on: as many of them as it can cover
+// within reuseScale frame sizes each way, at reuseQuality key pixels per frame
+// pixel for the deepest of them. Each frame has at least that, so frames zoom
+// in on one key image until they reach the quality limit, and zoom out from
+// one that takes in the wider frames ahead.
+static KeyImage planKeyImage(const std::vector<Keyframe>& keyframes, int first, int frameCount,
+                             const AnimationOptions& options) {
+    Keyframe start = animationAt(keyframes, first / options.fps, options.width, options.height);
+    int maxWidth = static_cast<int>(options.reuseScale * options.width);
+
+    // Extents in widths and heights of the first frame
+    double left = -0.5, right = 0.5, top = -0.5, bottom = 0.5;
+    double finest = 1.0;
+    int maxIterations = start.maxIterations;
+    int frames = 1;
+    for (int next = first + 1; next < frameCount; next++) {
+        Keyframe frame = animationAt(keyframes, next / options.fps, options.width, options.height);
+        double x = start.view.widthsTo(frame.view);
+        double y = start.view.heightsTo(frame.view);
+        double size = (frame.view.width / start.view.width).toDouble();
+        double newLeft = std::min(left, x - size / 2), newRight = std::max(right, x + size / 2);
+        double newTop = std::min(top, y - size / 2), newBottom = std::max(bottom, y + size / 2);
+        double newFinest = std::min(finest, size);
+        double extent = std::max(newRight - newLeft, newBottom - newTop);
+        if (std::ceil(extent / newFinest * options.reuseQuality * options.width) > maxWidth) {
+            break;
+        }
+        left = newLeft, right = newRight, top = newTop, bottom = newBottom;
+        finest = newFinest;
+        maxIterations = std::max(maxIterations, frame.maxIterations);
+        frames++;
+    }
+
+    // Square pixels at the quality the finest frame needs, over the square extent
+    double extent = std::max(right - left, bottom - top);
+    KeyImage key;
+    key.width = static_cast<int>(std::ceil(extent / finest * options.reuseQuality * options.width));
+    key.height = static_cast<int>(std::ceil(extent / finest * options.reuseQuality * options.height));
+    key.view.width = start.view.width * (key.width * finest / (options.reuseQuality * options.width));
+    key.view.height = start.view.height * (key.height * finest / (options.reuseQuality * options.height));
+    key.view.centerReal = start.view.centerReal +
+        FixedPoint::fromFloatExp(start.view.width * ((left + right) / 2), key.view.limbs());
+    key.view.centerImag = start.view.centerImag +
+        FixedPoint::fromFloatExp(start.view.height * ((top + bottom) / 2), key.view.limbs());
+    key.maxIterations = maxIterations;
+    key.frames = frames;
+    return key;
+}
+
+static void renderKeyImage(KeyImage& key, int threadCount) {
+    KernelFrame frame(key.view, key.width, key.height, key.maxIterations, IMAGE_KERNEL_FEATURES);
+    std::vector<EscapeResult> image = renderEscapeImage(frame, key.width, key.height, threadCount);
+    key.colors.resize(image.size());
+    for (size_t i = 0; i < image.size(); i++) {
+        key.colors[i] = colorForIterations(image[i].smooth, key.maxIterations);
+    }
+}
+
+// A frame as packed RGB, sampled bilinearly from a key image that covers it
+static void resampleKeyImage(const KeyImage& key, const Keyframe& frame, int width, int height, uint8_t* rgb) {
+    // Key pixel coordinates of the frame's pixel (0, 0), and per frame pixel
+    double scaleX = (frame.view.width / key.view.width).toDouble();
+    double scaleY = (frame.view.height / key.view.height).toDouble();
+    double u0 = (key.view.widthsTo(frame.view) - scaleX / 2 + 0.5) * key.width;
+    double v0 = (key.view.heightsTo(frame.view) - scaleY / 2 + 0.5) * key.height;
+    double du = scaleX * key.width / width;
+    double dv = scaleY * key.height / height;
+
+    for (int y = 0; y < height; y++) {
+        double v = std::max(0.0, std::min(key.height - 1.0, v0 + y * dv));
+        int row0 = std::min(static_cast<int>(v), std::max(0, key.height - 2));
+        int row1 = std::min(row0 + 1, key.height - 1);
+        float rowWeight = static_cast<float>(v - row0);
+        const uint32_t* near = key.colors.data() + static_cast<size_t>(row0) * key.width;
+        const uint32_t* far = key.colors.data() + static_cast<size_t>(row1) * key.width;
+        for (int x = 0; x < width; x++) {
+            double u = std::max(0.0, std::min(key.width - 1.0, u0 + x * du));
+            int column0 = std::min(static_cast<int>(u), std::max(0, key.width - 2));
+            int column1 = std::min(column0 + 1, key.width - 1);
+            float columnWeight = static_cast<float>(u - column0);
+            for (int shift = 0; shift < 24; shift += 8) {
+                auto channel = [&](uint32_t color) { return static_cast<float>((color >> shift) & 0xFF); };
+                float upper = channel(near[column0]) + (channel(near[column1]) - channel(near[column0])) * columnWeight;
+                float lower = channel(far[column0]) + (channel(far[column1]) - channel(far[column0])) * columnWeight;
+                *rgb++ = static_cast<uint8_t>(upper + (lower - upper) * rowWeight + 0.5f);
+            }
+        }
+    }
+}
+
+// A frame path from a pattern with one integer conversion, such as "frames/%05d.ppm"
+static bool validFramePattern(const std::string& pattern) {
+    size_t percent = pattern.find('%');
+    if (percent == std::string::npos || pattern.find('%', percent + 1) != std::string::npos) {
+        return false;
+    }
+    size_t conversion = pattern.find_first_not_of("0123456789", percent + 1);
+    return conversion != std::string::npos && pattern[conversion] == 'd';
+}
+
+static bool writePpm(const std::string& path, int width, int height, const uint8_t* rgb) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    size_t bytes = static_cast<size_t>(width) * height * 3;
+    bool ok = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0 && fwrite(rgb, 1, bytes, file) == bytes;
+    return fclose(file) == 0 && ok;
+}
+
+// The notes of the companion audio, sounding the point at the center of the
+// view every note interval, at the precision and cap the frame there uses
+static std::vector<ScheduledNote> scheduleAnimationNotes(const std::vector<Keyframe>& keyframes, double duration,
+                                                         const AnimationOptions& options) {
+    size_t count = static_cast<size_t>(duration / options.audio.interval) + 1;
+    std::vector<NoteParams> params(count);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; t++) {
+        threads.push_back(std::thread([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                Keyframe frame = animationAt(keyframes, i * options.audio.interval, options.width, options.height);
+                KernelFrame kernel(frame.view, options.width, options.height, frame.maxIterations,
+                                   IMAGE_KERNEL_FEATURES);
+                EscapeResult center;
+                kernel.renderRow(options.height / 2, options.width / 2, 1, &center);
+                params[i] = makeNoteParams(center.smooth, frame.view.centerReal.toDouble(),
+                                           frame.view.centerImag.toDouble(), frame.maxIterations,
+                                           options.audio.sampleRate);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return layoutNotes(params, options.audio);
+}
+
+static int runAnimate(int argc, char* args[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: mandelrender animate <keyframes.txt|-> <frame%05d.ppm|-> [--size WxH] [--fps n]"
+                     " [--exp-map] [--reuse] [--reuse-scale s] [--reuse-quality q] [--audio out.wav]"
+                     " [--note-interval s] [--crossfade s] [--rate hz] [--threads n]"
+                  << std::endl;
+        return 1;
+    }
+    const char* inputPath = args[0];
+    std::string outputPattern = args[1];
+    bool raw = outputPattern == "-";
+
+    AnimationOptions options;
+    options.audio.interval = ANIMATION_NOTE_INTERVAL;
+    for (int i = 2; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(args[i], "--size") && hasValue) {
+            if (sscanf(args[++i], "%dx%d", &options.width, &options.height) != 2) {
+                std::cerr << "--size expects WxH" << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(args[i], "--fps") && hasValue) {
+            options.fps = atof(args[++i]);
+        } else if (!strcmp(args[i], "--exp-map")) {
+            options.expMap = true;
+        } else if (!strcmp(args[i], "--reuse")) {
+            options.reuse = true;
+        } else if (!strcmp(args[i], "--reuse-scale") && hasValue) {
+            options.reuseScale = atof(args[++i]);
+        } else if (!strcmp(args[i], "--reuse-quality") && hasValue) {
+            options.reuseQuality = atof(args[++i]);
+        } else if (!strcmp(args[i], "--audio") && hasValue) {
+            options.audioPath = args[++i];
+        } else if (!strcmp(args[i], "--note-interval") && hasValue) {
+            options.audio.interval = atof(args[++i]);
+        } else if (!strcmp(args[i], "--crossfade") && hasValue) {
+            options.audio.crossfade = atof(args[++i]);
+        } else if (!strcmp(args[i], "--rate") && hasValue) {
+            options.audio.sampleRate = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--threads") && hasValue) {
+            options.threads = std::max(1, atoi(args[++i]));
+        } else {
+            std::cerr << "Unknown option: " << args[i] << std::endl;
+            return 1;
+        }
+    }
+    options.audio.threads = options.threads;
+    if (options.width <= 0 || options.height <= 0 || options.fps <= 0.0 || options.audio.interval <= 0.0 ||
+        options.audio.sampleRate <= 0) {
+        std::cerr << "--size, --fps, --note-interval and --rate must be positive" << std::endl;
+        return 1;
+    }
+    if (options.reuseQuality <= 0.0 || options.reuseScale < options.reuseQuality) {
+        std::cerr << "--reuse-quality must be positive and no more than --reuse-scale" << std::endl;
+        return 1;
+    }
+    if (options.reuse && options.expMap) {
+        std::cerr << "--reuse and --exp-map are alternatives" << std::endl;
+        return 1;
+    }
+    if (!raw && !validFramePattern(outputPattern)) {
+        std::cerr << "The output needs one frame number conversion, such as frame%05d.ppm, or - for raw RGB"
+                  << std::endl;
+        return 1;
+    }
+    if (raw && options.audioPath == "-") {
+        std::cerr << "Raw frames and audio cannot both go to standard output" << std::endl;
+        return 1;
+    }
+
+    std::vector<Keyframe> keyframes;
+    bool ok;
+    if (!strcmp(inputPath, "-")) {
+        ok = readKeyframes(std::cin, keyframes);
+    } else {
+        std::ifstream file(inputPath);
+        if (!file) {
+            std::cerr << "Could not open " << inputPath << std::endl;
+            return 1;
+        }
+        ok = readKeyframes(file, keyframes);
+    }
+    if (!ok) {
+        return 1;
+    }
+    if (keyframes.empty()) {
+        std::cerr << "No keyframes in " << inputPath << std::endl;
+        return 1;
+    }
+
+    // Frames run from time 0 through the last keyframe
+    double duration = keyframes.back().time;
+    int frameCount = static_cast<int>(std::floor(duration * options.fps + 1e-9)) + 1;
+
+    std::unique_ptr<ExpMap> expMap;
+    if (options.expMap) {
+        expMap = makeExpMap(keyframes, options);
+        if (!expMap) {
+            std::cerr << "--exp-map zooms into one point: every keyframe needs the same center" << std::endl;
+            return 1;
+        }
+        expMap->setFrameSize(options.width, options.height);
+        std::cerr << "Exponential map of " << expMap->columnCount() << "x" << expMap->rowCount() << std::endl;
+    }
+
+    // Each frame renders on one thread, so a batch keeps every core busy
+    // whatever the precision, and frames are written out in order
+    int batchFrames = options.threads * ANIMATION_BATCH_FRAMES;
+    size_t frameBytes = static_cast<size_t>(options.width) * options.height * 3;
+    std::vector<uint8_t> batch(batchFrames * frameBytes);
+    std::vector<Keyframe> frames(batchFrames);
+    std::shared_ptr<KeyImage> key;
+    std::vector<std::shared_ptr<KeyImage>> frameKeys(batchFrames);
+    int keyImages = 0;
+    std::vector<char> path(outputPattern.size() + 32);
+    for (int batchStart = 0; batchStart < frameCount; batchStart += batchFrames) {
+        int count = std::min(batchFrames, frameCount - batchStart);
+        for (int f = 0; f < count; f++) {
+            frames[f] = animationAt(keyframes, (batchStart + f) / options.fps, options.width, options.height);
+        }
+        if (options.reuse) {
+            // Key images in frame order, each rendered on every core as the first frame it covers comes up
+            for (int f = 0; f < count; f++) {
+                if (!key || key->frames == 0) {
+                    key = std::make_shared<KeyImage>(planKeyImage(keyframes, batchStart + f, frameCount, options));
+                    renderKeyImage(*key, options.threads);
+                    keyImages++;
+                }
+                frameKeys[f] = key;
+                key->frames--;
+            }
+        }
+        if (expMap) {
+            // The rows the whole batch spans, computed once and shared by its frames
+            int firstRow = expMap->rowCount();
+            int lastRow = 0;
+            for (int f = 0; f < count; f++) {
+                FloatExp spacing = frames[f].view.width / options.width;
+                firstRow = std::min(firstRow, expMap->firstRow(spacing, options.width, options.height));
+                lastRow = std::max(lastRow, expMap->lastRow(spacing));
+            }
+            expMap->keepRows(firstRow, lastRow, options.threads);
+        }
+
+        std::atomic<int> nextFrame(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < options.threads; t++) {
+            threads.push_back(std::thread([&]() {
+                std::vector<EscapeResult> row;
+                for (int f = nextFrame++; f < count; f = nextFrame++) {
+                    uint8_t* rgb = batch.data() + f * frameBytes;
+                    if (options.reuse) {
+                        resampleKeyImage(*frameKeys[f], frames[f], options.width, options.height, rgb);
+                    } else if (expMap) {
+                        expMap->renderFrame(frames[f].view.width / options.width, rgb);
+                    } else {
+                        renderAnimationFrame(frames[f], options.width, options.height, row, rgb);
+                    }
+                }
+            }));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (int f = 0; f < count; f++) {
+            const uint8_t* rgb = batch.data() + f * frameBytes;
+            if (raw) {
+                ok = fwrite(rgb, 1, frameBytes, stdout) == frameBytes;
+            } else {
+                snprintf(path.data(), path.size(), outputPattern.c_str(), batchStart + f);
+                ok = writePpm(path.data(), options.width, options.height, rgb);
+            }
+            if (!ok) {
+                std::cerr << "Failed writing frame " << batchStart + f << std::endl;
+                return 1;
+            }
+        }
+        std::cerr << "\rFrame " << batchStart + count << "/" << frameCount << std::flush;
+    }
+    std::cerr << std::endl;
+    if (raw && fflush(stdout) != 0) {
+        std::cerr << "Failed writing frames" << std::endl;
+        return 1;
+    }
+
+    if (!options.audioPath.empty()) {
+        // Padded to the length of the video, so the two line up from the first frame
+        std::vector<ScheduledNote> notes = scheduleAnimationNotes(keyframes, duration, options);
+        OutputFormat format = { options.audio.sampleRate, SYNTH_CHANNELS, SampleFormat::Int16 };
+        long long videoSamples = std::llround(frameCount / options.fps * format.sampleRate);
+        WavWriter wav;
+        if (!wav.open(options.audioPath.c_str(), format.sampleRate, format.channels)) {
+            std::cerr << "Could not open " << options.audioPath << " for writing" << std::endl;
+            return 1;
+        }
+        if (!renderAudio(notes, format, wav, options.threads, videoSamples) || !wav.close()) {
+            std::cerr << "Failed writing " << options.audioPath << std::endl;
+            return 1;
+        }
+    }
+
+    std::cerr << "Rendered " << frameCount << " frames of " << options.width << "x" << options.height << " at "
+              << options.fps << " fps";
+    if (options.reuse) {
+        std::cerr << " from " << keyImages << " key images";
+    }
+    if (raw) {
+        std::cerr << " as raw rgb24; encode with: ffmpeg -f rawvideo -pix_fmt rgb24 -s " << options.width << "x"
+                  << options.height << " -r " << options.fps << " -i - out.mp4";
+    }
+    std::cerr << std::endl;
+    return 0;
+}
+
+// A smooth count off by more than this shifts the hue noticeably
+const float VISIBLE_SMOOTH_ERROR = 0.5f;
+
+// Orbits on the boundary are chaotic, so a few of its pixels differ between any two
+// precisions; more than this fraction of the image would show
+const double MAX_VISIBLE_ERROR_FRACTION = 0.005;
+
+// Fraction of pixels whose colour would differ between two renders
+static double visibleErrorFraction(const std::vector<EscapeResult>& image, const std::vector<EscapeResult>& reference) {
+    size_t visible = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        if (std::fabs(image[i].smooth - reference[i].smooth) > VISIBLE_SMOOTH_ERROR) {
+            visible++;
+        }
+    }
+    return static_cast<double>(visible) / image.size();
+}
+
+struct PrecisionCase {
+    const char* name;
+    double centerReal;
+    double centerImag;
+    int maxIterations;
+};
+
+// Boundary-heavy views, where rounding error shows first
+const PrecisionCase PRECISION_CASES[] = {
+    { "overview", -0.5, 0.0, 100 },
+    { "overview-deep-iter", -0.5, 0.0, 300 },
+    { "seahorse valley", -0.743643887, 0.131825904, 500 },
+    { "elephant valley", 0.2925, 0.0149, 500 },
+    { "antenna", -1.7685, 0.0013, 500 },
+    { "minibrot", -1.7497591451303665, 0.0, 1000 },
+};
+
+// A point where choosePrecision hands over from one precision to the next
+struct PrecisionSwitch {
+    KernelPrecision coarse;
+    KernelPrecision fine;
+    double epsilon;               // Of the coarse precision
+    KernelPrecision reference;    // Trusted well past the switch
+};
+
+const PrecisionSwitch PRECISION_SWITCHES[] = {
+    { KernelPrecision::Float, KernelPrecision::Double, std::numeric_limits<float>::epsilon(),
+      KernelPrecision::DoubleDouble },
+    { KernelPrecision::Double, KernelPrecision::DoubleDouble, std::numeric_limits<double>::epsilon(),
+      KernelPrecision::DoubleDouble },
+    { KernelPrecision::DoubleDouble, KernelPrecision::Perturbation, kernelEpsilon<DoubleDouble>(),
+      KernelPrecision::Perturbation },
+};
+
+// Views past the range of doubles near Misiurewicz points, which sit on the
+// boundary exactly as doubles, so escapes there take hundreds of iterations.
+// An off-center point leaves the view center escaping early, so the reference
+// orbit has to be found elsewhere in the view.
+struct DeepCase {
+    const char* name;
+    double pointReal;
+    double pointImag;
+    long long spacingExponent;  // Pixel spacing is 0.75 * 2^spacingExponent
+    int centerOffset;           // Pixels from the point to the view center
+    int maxIterations;
+};
+
+const DeepCase DEEP_CASES[] = {
+    { "misiurewicz i, 1e-300", 0.0, 1.0, -996, 0, 2000 },
+    { "misiurewicz i, 1e-330", 0.0, 1.0, -1096, 0, 2000 },
+    { "misiurewicz -i off center, 1e-300", 0.0, -1.0, -996, 100, 2000 },
+};
+
+// Pixels of each deep view checked against a plain fixed-point orbit
+const int DEEP_SAMPLE_COLUMNS = 16;
+const int DEEP_SAMPLE_ROWS = 12;
+
+// Zoomed-out views from one about level 0's width to far past it, in units;
+// none may take more tiles than a level-0 grid over the frame has
+const double WIDE_VIEW_WIDTHS[] = { 50.0, 400.0, 4000.0, 1e6 };
+const int WIDE_VIEW_WIDTH = 800;
+const int WIDE_VIEW_HEIGHT = 600;
+const int WIDE_VIEW_MAX_TILES = (WIDE_VIEW_WIDTH / TILE_SIZE + 2) * (WIDE_VIEW_HEIGHT / TILE_SIZE + 2);
+
+// The smooth count of one point, iterated entirely in fixed point
+static EscapeResult fixedPointEscape(const FixedPoint& real, const FixedPoint& imag, int maxIterations) {
+    ReferenceOrbit orbit = computeReferenceOrbit(real, imag, maxIterations);
+    int last = orbit.last();
+    return finishEscape<KERNEL_SMOOTH>(orbit.real[last], orbit.imag[last], 0.0, 0.0, real.toDouble(),
+                                       imag.toDouble(), orbit.escapeIteration, maxIterations);
+}
+
+static int runVerifyPrecision(int argc, char* args[]) {
+    int threadCount = NUM_THREADS;
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(args[i], "--threads") && i + 1 < argc) {
+            threadCount = std::max(1, atoi(args[++i]));
+        } else {
+            std::cerr << "Unknown option: " << args[i] << std::endl;
+            return 1;
+        }
+    }
+
+    const int width = 256;
+    const int height = 192;
+    bool passed = true;
+    for (const PrecisionSwitch& change : PRECISION_SWITCHES) {
+        for (const PrecisionCase& test : PRECISION_CASES) {
+            // The finest spacing the coarse precision is trusted with; half of it
+            // must already go to the fine one
+            double spacing = std::nextafter(change.epsilon * 2 * PRECISION_HEADROOM * test.maxIterations, 1.0);
+            KernelPrecision chosen = choosePrecision(spacing, test.maxIterations);
+            if (chosen != change.coarse || choosePrecision(spacing * 0.5, test.maxIterations) != change.fine) {
+                std::cerr << test.name << ": the " << precisionName(change.coarse) << " to "
+                          << precisionName(change.fine) << " switch is not where verify-precision expects it" << std::endl;
+                return 1;
+            }
+
+            View view = View::around(test.centerReal, test.centerImag, spacing * width, spacing * height);
+            std::vector<EscapeResult> image = renderEscapeImage(
+                KernelFrame(view, width, height, test.maxIterations, IMAGE_KERNEL_FEATURES, chosen),
+                width, height, threadCount);
+            std::vector<EscapeResult> reference = renderEscapeImage(
+                KernelFrame(view, width, height, test.maxIterations, IMAGE_KERNEL_FEATURES, change.reference),
+                width, height, threadCount);
+
+            double fraction = visibleErrorFraction(image, reference);
+            bool ok = fraction <= MAX_VISIBLE_ERROR_FRACTION;
+            passed = passed && ok;
+            std::cout << (ok ? "ok   " : "FAIL ") << test.name << ": " << precisionName(chosen)
+                      << " at spacing " << spacing << ", " << fraction * 100 << "% of pixels visibly off "
+                      << "(limit " << MAX_VISIBLE_ERROR_FRACTION * 100 << "%)" << std::endl;
+        }
+    }
+
+    for (const DeepCase& test : DEEP_CASES) {
+        FloatExp spacing(0.75, test.spacingExponent);
+        View view = View::around(test.pointReal, test.pointImag, 0.0, 0.0);
+        view.width = spacing * width;
+        view.height = spacing * height;
+        view.centerReal = view.centerReal + FixedPoint::fromFloatExp(spacing * test.centerOffset, view.limbs());
+        view.centerImag = view.centerImag.withLimbs(view.limbs());
+        KernelFrame frame(view, width, height, test.maxIterations, IMAGE_KERNEL_FEATURES);
+        if (frame.precision() != KernelPrecision::Perturbation) {
+            std::cerr << test.name << ": not rendered by perturbation" << std::endl;
+            return 1;
+        }
+
+        // Sample pixels spread over the view, off the axes through the center
+        std::vector<int> samples(DEEP_SAMPLE_COLUMNS * DEEP_SAMPLE_ROWS);
+        std::atomic<int> nextSample(0);
+        std::atomic<int> visible(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([&]() {
+                for (int i = nextSample++; i < static_cast<int>(samples.size()); i = nextSample++) {
+                    int x = (i % DEEP_SAMPLE_COLUMNS) * width / DEEP_SAMPLE_COLUMNS + 3;
+                    int y = (i / DEEP_SAMPLE_COLUMNS) * height / DEEP_SAMPLE_ROWS + 5;
+                    EscapeResult perturbed;
+                    frame.renderRow(y, x, 1, &perturbed);
+                    EscapeResult exact = fixedPointEscape(view.realAt(x, width), view.imagAt(y, height),
+                                                          test.maxIterations);
+                    if (std::fabs(perturbed.smooth - exact.smooth) > VISIBLE_SMOOTH_ERROR) {
+                        visible++;
+                    }
+                }
+            }));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        bool ok = visible == 0;
+        passed = passed && ok;
+        std::cout << (ok ? "ok   " : "FAIL ") << test.name << ": perturbation, " << visible << " of "
+                  << samples.size() << " sampled pixels visibly off" << std::endl;
+    }
+
+    for (double wideWidth : WIDE_VIEW_WIDTHS) {
+        View view = View::around(-0.75, 0.0, wideWidth, wideWidth * WIDE_VIEW_HEIGHT / WIDE_VIEW_WIDTH);
+        TileCache cache(TILE_CACHE_BUDGET_BYTES);
+        TileRenderStats stats;
+        std::vector<float> counts(static_cast<size_t>(WIDE_VIEW_WIDTH) * WIDE_VIEW_HEIGHT);
+        renderFromTiles(cache, nullptr, view, WIDE_VIEW_WIDTH, WIDE_VIEW_HEIGHT, 100, FORMULA_MANDELBROT,
+                        threadCount, counts.data(), nullptr, &stats);
+        // No tiles are coarser than these views' own, so a zoom-out preview has nothing to offer
+        bool previewed = renderPreview(cache, nullptr, view, WIDE_VIEW_WIDTH, WIDE_VIEW_HEIGHT, 100,
+                                       FORMULA_MANDELBROT, threadCount, counts.data());
+        bool ok = stats.tilesComputed <= WIDE_VIEW_MAX_TILES && !previewed;
+        passed = passed && ok;
+        std::cout << (ok ? "ok   " : "FAIL ") << "view " << wideWidth << " wide: " << stats.tilesComputed
+                  << " tiles (limit " << WIDE_VIEW_MAX_TILES << "), preview "
+                  << (previewed ? "drawn" : "skipped") << std::endl;
+    }
+    return passed ? 0 : 1;
+}
+
+// A distance estimate off by more than this fraction draws the boundary at another width
+const float VISIBLE_DISTANCE_ERROR = 0.01f;
+
+// Fraction of pixels whose colour or distance estimate would differ between two renders
+static double visibleDistanceErrorFraction(const std::vector<EscapeResult>& image,
+                                           const std::vector<EscapeResult>& reference) {
+    size_t visible = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        float distance = std::fabs(image[i].distance - reference[i].distance);
+        if (std::fabs(image[i].smooth - reference[i].smooth) > VISIBLE_SMOOTH_ERROR ||
+            distance > VISIBLE_DISTANCE_ERROR * std::fabs(reference[i].distance)) {
+            visible++;
+        }
+    }
+    return static_cast<double>(visible) / image.size();
+}
+
+static int runVerifyFormulas(int argc, char* args[]) {
+    int threadCount = NUM_THREADS;
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(args[i], "--threads") && i + 1 < argc) {
+            threadCount = std::max(1, atoi(args[++i]));
+        } else {
+            std::cerr << "Unknown option: " << args[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // Every built-in formula's expression, compiled, against the built-in kernels,
+    // over a view that holds all of their sets
+    const int width = 256;
+    const int height = 192;
+    const int maxIterations = 200;
+    const unsigned features = IMAGE_KERNEL_FEATURES | KERNEL_DISTANCE;
+    View view = View::around(-0.25, 0.0, 4.0, 3.0);
+    bool passed = true;
+    for (FormulaId builtin = 0; builtin < BUILTIN_FORMULA_COUNT; builtin++) {
+        const FormulaEntry& entry = FormulaRegistry::instance().get(builtin);
+        std::string error;
+        FormulaId compiled = compileFormula(entry.expression, error);
+        if (compiled < 0) {
+            std::cout << "FAIL " << entry.name << ": " << entry.expression << " did not compile: " << error
+                      << std::endl;
+            passed = false;
+            continue;
+        }
+        for (KernelPrecision precision : { KernelPrecision::Float, KernelPrecision::Double,
+                                           KernelPrecision::DoubleDouble }) {
+            std::vector<EscapeResult> image = renderEscapeImage(
+                KernelFrame(view, width, height, maxIterations, features, precision, nullptr, compiled),
+                width, height, threadCount);
+            std::vector<EscapeResult> reference = renderEscapeImage(
+                KernelFrame(view, width, height, maxIterations, features, precision, nullptr, builtin),
+                width, height, threadCount);
+
+            double fraction = visibleDistanceErrorFraction(image, reference);
+            bool ok = fraction <= MAX_VISIBLE_ERROR_FRACTION;
+            passed = passed && ok;
+            std::cout << (ok ? "ok   " : "FAIL ") << entry.name << ": " << entry.expression << " compiled, in "
+                      << precisionName(precision) << ", " << fraction * 100 << "% of pixels visibly off "
+                      << "(limit " << MAX_VISIBLE_ERROR_FRACTION * 100 << "%)" << std::endl;
+        }
+    }
+    return passed ? 0 : 1;
+}
+
+#if defined(TILE_STORE_SUPPORTED)
+// Largest difference between two tiles' counts
+static float tileDifference(const std::vector<float>& tile, const std::vector<float>& reference) {
+    float largest = 0.0f;
+    for (size_t i = 0; i < tile.size(); i++) {
+        largest = std::max(largest, std::fabs(tile[i] - reference[i]));
+    }
+    return largest;
+}
+
+static size_t fileSize(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+// A new store with one record per key, each appended by a writer of its own.
+// offsets gets where the first record begins and where each one ends.
+static bool writeTiles(const std::string& path, const std::vector<TileKey>& keys, const std::vector<float>& tile,
+                       std::vector<size_t>& offsets) {
+    std::remove(path.c_str());
+    offsets.clear();
+    for (size_t i = 0; i <= keys.size(); i++) {
+        TileStore store;
+        if (!store.open(path) || !store.isWriter()) {
+            std::cerr << "Could not open " << path << " for writing" << std::endl;
+            return false;
+        }
+        if (i > 0) {
+            store.insert(keys[i - 1], KernelPrecision::Double, tile);
+        }
+        store.close();
+        offsets.push_back(fileSize(path));
+    }
+    return true;
+}
+
+static void flipByte(const std::string& path, size_t offset) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(offset));
+    char byte = static_cast<char>(file.get());
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.put(static_cast<char>(byte ^ 0x01));
+}
+#endif
+
+static int runVerifyStore(int argc, char* args[]) {
+    if (argc > 0) {
+        std::cerr << "Unknown option: " << args[0] << std::endl;
+        return 1;
+    }
+#if !defined(TILE_STORE_SUPPORTED)
+    std::cout << "The tile store is not supported in this build" << std::endl;
+    return 0;
+#else
+    const float tolerance = 1.0f / TILE_STORE_COUNT_SCALE;
+    bool passed = true;
+
+    // Counts back from the compression within one step of the fixed point, both for a tile
+    // that is half inside the set and for one where no two neighbouring counts are equal
+    std::vector<float> interior(TILE_SIZE * TILE_SIZE);
+    std::vector<float> distinct(TILE_SIZE * TILE_SIZE);
+    for (size_t i = 0; i < interior.size(); i++) {
+        interior[i] = i < interior.size() / 2 ? 1000.0f : 1000.0f - (i % 97) * 0.37f;
+        distinct[i] = 1.0f + i * 0.013f;
+    }
+    struct RoundTrip {
+        const char* name;
+        const std::vector<float>* counts;
+    };
+    for (const RoundTrip& test : { RoundTrip{ "interior runs", &interior }, RoundTrip{ "no runs", &distinct } }) {
+        std::vector<uint8_t> encoded;
+        encodeTile(*test.counts, encoded);
+        std::vector<float> decoded(test.counts->size());
+        bool decodes = decodeTile(encoded.data(), encoded.size(), decoded);
+        float difference = decodes ? tileDifference(decoded, *test.counts) : 0.0f;
+        bool ok = decodes && difference <= tolerance;
+        passed = passed && ok;
+        std::cout << (ok ? "ok   " : "FAIL ") << "round trip, " << test.name << ": " << encoded.size() << " bytes, "
+                  << (decodes ? "largest error " + std::to_string(difference) : std::string("does not decode"))
+                  << " (limit " << tolerance << ")" << std::endl;
+    }
+
+    const char* temporary = std::getenv("TMPDIR");
+    std::string path = std::string(temporary != nullptr ? temporary : "/tmp") + "/mandelrender-verify-store-" +
+                       std::to_string(getpid()) + ".tiles";
+    View view = View::around(-0.5, 0.0, 1.0, 1.0);
+    TileGrid grid(view, TILE_SIZE, TILE_SIZE, tileLevelFor(view.width / TILE_SIZE));
+    std::vector<TileKey> keys;
+    for (int column = 0; column < 3; column++) {
+        keys.push_back(grid.key(column, 0, 1000, FORMULA_MANDELBROT));
+    }
+    std::vector<size_t> offsets;
+    auto indexed = [&](TileStore& store, size_t i) {
+        TileCache::Tile tile = store.find(keys[i], KernelPrecision::Double);
+        return tile != nullptr && tileDifference(*tile, interior) <= tolerance;
+    };
+
+    // A record cut off partway, as a writer killed mid-append leaves it, is dropped
+    // and cut from the file by the next writer
+    if (!writeTiles(path, { keys[0], keys[1] }, interior, offsets) ||
+        truncate(path.c_str(), static_cast<off_t>((offsets[1] + offsets[2]) / 2)) != 0) {
+        std::remove(path.c_str());
+        return 1;
+    }
+    {
+        TileStore store;
+        bool ok = store.open(path) && store.tileCount() == 1 && indexed(store, 0) &&
+                  store.find(keys[1], KernelPrecision::Double) == nullptr && fileSize(path) == offsets[1];
+        passed = passed && ok;
+        std::cout << (ok ? "ok   " : "FAIL ") << "torn record: " << store.tileCount() << " of 2 tiles indexed, file "
+                  << fileSize(path) << " bytes (expected " << offsets[1] << ")" << std::endl;
+    }
+
+    // A flipped byte fails its record's checksum, so that record is never indexed.
+    // Damage to the last record is a torn tail; damage to the first, in its length
+    // or in its payload, must leave the records after it indexed and in the file.
+    struct Damage {
+        const char* name;
+        size_t record;
+        bool inHeader;
+    };
+    for (const Damage& damage : { Damage{ "last record's payload", 2, false },
+                                  Damage{ "first record's payload", 0, false },
+                                  Damage{ "first record's header", 0, true } }) {
+        if (!writeTiles(path, keys, interior, offsets)) {
+            std::remove(path.c_str());
+            return 1;
+        }
+        // The header's second word is the payload length
+        flipByte(path, damage.inHeader ? offsets[damage.record] + 4 : offsets[damage.record + 1] - 1);
+        bool tail = damage.record == keys.size() - 1;
+        size_t expectedSize = tail ? offsets[damage.record] : offsets.back();
+        TileStore store;
+        bool ok = store.open(path) && store.isWriter() && store.tileCount() == keys.size() - 1 &&
+                  fileSize(path) == expectedSize;
+        for (size_t i = 0; i < keys.size(); i++) {
+            ok = ok && indexed(store, i) == (i != damage.record);
+        }
+        passed = passed && ok;
+        std::cout << (ok ? "ok   " : "FAIL ") << "flipped byte in the " << damage.name << ": " << store.tileCount()
+                  << " of " << keys.size() << " tiles indexed, file " << fileSize(path) << " bytes (expected "
+                  << expectedSize << ")" << std::endl;
+    }
+    std::remove(path.c_str());
+    return passed ? 0 : 1;
+#endif
+}
+
+int main(int argc, char* args[]) {
+    if (argc >= 2 && !strcmp(args[1], "audio")) {
+        return runAudio(argc - 2, args + 2);
+    }
+    if (argc >= 2 && !strcmp(args[1], "animate")) {
+        return runAnimate(argc - 2, args + 2);
+    }
+    if (argc >= 2 && !strcmp(args[1], "verify-precision")) {
+        return runVerifyPrecision(argc - 2, args + 2);
+    }
+    if (argc >= 2 && !strcmp(args[1], "verify-formulas")) {
+        return runVerifyFormulas(argc - 2, args + 2);
+    }
+    if (argc >= 2 && !strcmp(args[1], "verify-store")) {
+        return runVerifyStore(argc - 2, args + 2);
+    }
+
+    std::cerr << "Usage: mandelrender audio <points.txt|-> <out.wav|-> [options]" << std::endl;
+    std::cerr << "       mandelrender animate <keyframes.txt|-> <frame%05d.ppm|-> [options]" << std::endl;
+    std::cerr << "       mandelrender verify-precision [--threads n]" << std::endl;
+    std::cerr << "       mandelrender verify-formulas [--threads n]" << std::endl;
+    std::cerr << "       mandelrender verify-store" << std::endl;
+    return 1;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// Timing of the render pipeline. It is only collected while something shows
+// it: renders take a stats pointer that is null otherwise, and every timer and
+// counter sits behind that check, so turning it off leaves one branch per
+// stage and per tile.
+
+typedef std::chrono::steady_clock RenderClock;
+
+inline double millisecondsBetween(RenderClock::time_point start, RenderClock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Adds the time until the end of the scope to *total, unless total is null
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double* total) : total(total) {
+        if (total != nullptr) {
+            start = RenderClock::now();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (total != nullptr) {
+            *total += millisecondsBetween(start, RenderClock::now());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    double* total;
+    RenderClock::time_point start;
+};
+
+// One tile the kernel computed
+struct TileTiming {
+    int level;
+    int worker;
+    double startMs;  // From the start of the render, so tiles line up per worker
+    double endMs;
+    long long iterations;  // Escape iterations over its pixels; the cap inside the set
+};
+
+struct WorkerTiming {
+    double busyMs = 0.0;  // Inside tile computations
+    int tiles = 0;
+};
+
+// What a tiled render did. Counters add up, so a render that loads tiles in
+// several passes reports them all.
+struct TileRenderStats {
+    RenderClock::time_point start = RenderClock::now();
+    int tilesFound = 0;     // From the cache or the store
+    int tilesComputed = 0;
+    long long computedPixels = 0;
+    double computeMs = 0.0;  // Wall time while workers ran
+    std::vector<WorkerTiming> workers;
+    std::vector<TileTiming> tiles;
+
+    long long iterations() const {
+        long long total = 0;
+        for (const TileTiming& tile : tiles) {
+            total += tile.iterations;
+        }
+        return total;
+    }
+
+    // Least and most busy worker, in fractions of the compute time
+    double minLoad() const { return load(true); }
+    double maxLoad() const { return load(false); }
+
+private:
+    double load(bool least) const {
+        if (workers.empty() || computeMs <= 0.0) {
+            return 0.0;
+        }
+        auto busiest = std::minmax_element(workers.begin(), workers.end(),
+            [](const WorkerTiming& a, const WorkerTiming& b) { return a.busyMs < b.busyMs; });
+        return (least ? busiest.first : busiest.second)->busyMs / computeMs;
+    }
+};
+
+// The stages of a frame from the first tile to the screen
+enum FrameStage {
+    STAGE_TILES,    // Finding and computing tiles, and sampling them into the frame
+    STAGE_COLOR,
+    STAGE_QUEUE,    // Finished in the background, waiting for the main loop to show it
+    STAGE_UPLOAD,   // Into the texture
+    STAGE_PRESENT,
+    STAGE_COUNT
+};
+
+inline const char* frameStageName(FrameStage stage) {
+    switch (stage) {
+        case STAGE_TILES: return "tiles";
+        case STAGE_COLOR: return "color";
+        case STAGE_QUEUE: return "queue";
+        case STAGE_UPLOAD: return "upload";
+        case STAGE_PRESENT: return "present";
+        default: return "?";
+    }
+}
+
+struct FrameStats {
+    const char* kind = "";  // Which pass produced the frame
+    double timeSeconds = 0.0;  // When it was shown
+    int pixels = 0;
+    double stageMs[STAGE_COUNT] = {};
+    double totalMs = 0.0;  // From the first tile to the end of present
+    double eventsMs = 0.0;   // Main loop handling events since the previous frame
+    double eventLagMs = 0.0;  // Oldest event's wait before it was handled, in that time
+    TileRenderStats tiles;
+
+    double mpixelsPerSecond() const { return totalMs > 0.0 ? pixels / totalMs / 1000.0 : 0.0; }
+
+    // Over the pixels of the computed tiles, since cached ones cost nothing
+    double iterationsPerPixel() const {
+        return tiles.computedPixels > 0 ? static_cast<double>(tiles.iterations()) / tiles.computedPixels : 0.0;
+    }
+};
+
+// The last frames' stats, oldest overwritten first
+class FrameLog {
+public:
+    explicit FrameLog(size_t capacity) : capacity(capacity) {}
+
+    void push(const FrameStats& stats) {
+        if (frames.size() < capacity) {
+            frames.push_back(stats);
+        } else {
+            frames[next] = stats;
+        }
+        next = (next + 1) % capacity;
+    }
+
+    // Oldest first
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        size_t start = frames.size() < capacity ? 0 : next;
+        for (size_t i = 0; i < frames.size(); i++) {
+            visit(frames[(start + i) % frames.size()]);
+        }
+    }
+
+    bool empty() const { return frames.empty(); }
+
+    FrameStats& latest() { return frames[(next + capacity - 1) % capacity]; }
+    const FrameStats& latest() const { return frames[(next + capacity - 1) % capacity]; }
+
+private:
+    size_t capacity;
+    size_t next = 0;
+    std::vector<FrameStats> frames;
+};
+
+inline void writeFrameStatsJson(std::ostream& out, const FrameStats& stats) {
+    out << "{\"time_s\":" << stats.timeSeconds
+        << ",\"kind\":\"" << stats.kind << "\""
+        << ",\"pixels\":" << stats.pixels
+        << ",\"total_ms\":" << stats.totalMs;
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        out << ",\"" << frameStageName(static_cast<FrameStage>(stage)) << "_ms\":" << stats.stageMs[stage];
+    }
+    out << ",\"events_ms\":" << stats.eventsMs
+        << ",\"event_lag_ms\":" << stats.eventLagMs
+        << ",\"tiles_found\":" << stats.tiles.tilesFound
+        << ",\"tiles_computed\":" << stats.tiles.tilesComputed
+        << ",\"tile_iterations\":" << stats.tiles.iterations()
+        << ",\"compute_ms\":" << stats.tiles.computeMs
+        << ",\"worker_busy_ms\":[";
+    for (size_t i = 0; i < stats.tiles.workers.size(); i++) {
+        out << (i == 0 ? "" : ",") << stats.tiles.workers[i].busyMs;
+    }
+    out << "]}" << std::endl;
+}
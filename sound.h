@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "mandelbrot.h"
+#include "trace.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Audio settings. The synth runs at whatever rate the output asks for;
+// this is only the rate requested when nothing else is known.
+const int DEFAULT_SAMPLE_RATE = 44100;
+
+// Notes are synthesized as interleaved float32 stereo
+const int SYNTH_CHANNELS = 2;
+
+// Everything needed to synthesize the note for one point
+struct NoteParams {
+    int sampleRate;
+    double duration;
+    double primaryFreq;
+    double secondaryFreq1;
+    double secondaryFreq2;
+    double harmonicFreq;
+};
+
+// Derive the note for a point from its (smooth) iteration count and position
+inline NoteParams makeNoteParams(double iterations, double real, double imag, int maxIterations, int sampleRate) {
+    NoteParams note;
+    note.sampleRate = sampleRate;
+    note.duration = 1.0;  // Reduced to 1 second for better responsiveness
+
+    if (iterations >= maxIterations) {
+        note.primaryFreq = 110.0;  // A2
+    } else {
+        note.primaryFreq = mapValue(iterations, 0, maxIterations, 220.0, 880.0);
+    }
+
+    note.secondaryFreq1 = note.primaryFreq * (1.0 + real * 0.1);
+    note.secondaryFreq2 = note.primaryFreq * (1.0 + imag * 0.1);
+    note.harmonicFreq = note.primaryFreq * 1.5;
+    return note;
+}
+
+// Length of the note in frames (one sample per channel)
+inline int noteSampleCount(const NoteParams& note) {
+    return static_cast<int>(note.sampleRate * note.duration);
+}
+
+// ADSR envelope shape, in seconds and relative level
+const double ATTACK_TIME = 0.05;  // Shorter attack
+const double DECAY_TIME = 0.1;    // Shorter decay
+const double SUSTAIN_LEVEL = 0.7;
+const double RELEASE_TIME = 0.3;  // Shorter release
+
+// Samples are synthesized in blocks of this size (a multiple of the SIMD width)
+const int SYNTH_BLOCK_SIZE = 256;
+
+typedef float float4 __attribute__((vector_size(16)));
+
+// Write the envelope for samples [firstSample, firstSample + count) of the note.
+// The ADSR is piecewise linear, so each stage is filled as a single ramp
+// instead of deciding the stage per sample.
+inline void fillNoteEnvelope(const NoteParams& note, int firstSample, int count, float* envelope) {
+    struct Stage { double startTime, endTime, startLevel, endLevel; };
+    const double duration = note.duration;
+    const double rate = note.sampleRate;
+    const Stage stages[] = {
+        { 0.0, ATTACK_TIME, 0.0, 1.0 },
+        { ATTACK_TIME, ATTACK_TIME + DECAY_TIME, 1.0, SUSTAIN_LEVEL },
+        { ATTACK_TIME + DECAY_TIME, duration - RELEASE_TIME, SUSTAIN_LEVEL, SUSTAIN_LEVEL },
+        { duration - RELEASE_TIME, duration, SUSTAIN_LEVEL, 0.0 },
+    };
+
+    int filled = 0;
+    for (const Stage& stage : stages) {
+        int stageEnd = static_cast<int>(std::ceil(stage.endTime * rate)) - firstSample;
+        if (stageEnd <= filled) {
+            continue;
+        }
+        stageEnd = std::min(stageEnd, count);
+
+        // level(i) = startLevel + slope * (i - stageStart), with i the sample index in the note
+        double slope = (stage.endLevel - stage.startLevel) / ((stage.endTime - stage.startTime) * rate);
+        double level = stage.startLevel + slope * (firstSample + filled - stage.startTime * rate);
+        for (int n = filled; n < stageEnd; n++) {
+            envelope[n] = static_cast<float>(level);
+            level += slope;
+        }
+        filled = stageEnd;
+    }
+    // Past the release the note is silent
+    for (int n = filled; n < count; n++) {
+        envelope[n] = 0.0f;
+    }
+}
+
+// Add frames [firstSample, firstSample + count) of the note to the interleaved
+// stereo buffer out, scaled by gain. Sample indices are relative to the note
+// start, so any slice of a note can be rendered independently and the slices
+// join without discontinuities.
+inline void renderNoteSamples(const NoteParams& note, int firstSample, int count, float* out, float gain = 1.0f) {
+    TraceScope trace("audio", "synth", count);
+    const double freqs[] = { note.primaryFreq, note.secondaryFreq1, note.secondaryFreq2, note.harmonicFreq };
+    const float weights[] = { 0.5f, 0.25f, 0.15f, 0.1f };
+
+    alignas(16) float mix[SYNTH_BLOCK_SIZE];
+    alignas(16) float envelope[SYNTH_BLOCK_SIZE];
+
+    for (int blockStart = 0; blockStart < count; blockStart += SYNTH_BLOCK_SIZE) {
+        int blockLength = std::min(SYNTH_BLOCK_SIZE, count - blockStart);
+        long long blockFirst = static_cast<long long>(firstSample) + blockStart;
+
+        for (int n = 0; n < SYNTH_BLOCK_SIZE; n++) {
+            mix[n] = 0.0f;
+        }
+
+        // Each partial is a phasor holding four consecutive samples, rotated four
+        // samples ahead per step. The phase is re-derived exactly at each block
+        // start, so float rounding cannot accumulate across blocks.
+        for (int p = 0; p < 4; p++) {
+            double cycles = freqs[p] / note.sampleRate;
+            float4 s, c;
+            for (int k = 0; k < 4; k++) {
+                double phase = 2.0 * M_PI * (cycles * (blockFirst + k) - std::floor(cycles * (blockFirst + k)));
+                s[k] = static_cast<float>(sin(phase));
+                c[k] = static_cast<float>(cos(phase));
+            }
+            float sinStep = static_cast<float>(sin(2.0 * M_PI * cycles * 4));
+            float cosStep = static_cast<float>(cos(2.0 * M_PI * cycles * 4));
+            float weight = weights[p];
+
+            for (int n = 0; n < blockLength; n += 4) {
+                float4* m = reinterpret_cast<float4*>(mix + n);
+                *m += weight * s;
+                float4 rotated = s * cosStep + c * sinStep;
+                c = c * cosStep - s * sinStep;
+                s = rotated;
+            }
+        }
+
+        fillNoteEnvelope(note, static_cast<int>(blockFirst), blockLength, envelope);
+        float* dst = out + static_cast<size_t>(blockStart) * SYNTH_CHANNELS;
+        for (int n = 0; n < blockLength; n++) {
+            // Notes are centred: both channels at full level, like the old mono output
+            float sample = mix[n] * envelope[n] * gain;
+            dst[2 * n] += sample;
+            dst[2 * n + 1] += sample;
+        }
+    }
+}
+
+// Create a musical sound based on Mandelbrot properties, as interleaved float stereo
+inline std::vector<float> createMandelbrotSound(double iterations, double real, double imag, int maxIterations,
+                                                int sampleRate) {
+    NoteParams note = makeNoteParams(iterations, real, imag, maxIterations, sampleRate);
+
+    int sampleCount = noteSampleCount(note);
+    std::vector<float> buffer(static_cast<size_t>(sampleCount) * SYNTH_CHANNELS, 0.0f);
+    renderNoteSamples(note, 0, sampleCount, buffer.data());
+    return buffer;
+}
+
+// Sample encodings the output stage can produce, all in native byte order
+enum class SampleFormat {
+    Float32,
+    Int16,
+    Int32,
+};
+
+// What the device (or file) actually consumes
+struct OutputFormat {
+    int sampleRate;
+    int channels;
+    SampleFormat format;
+
+    int bytesPerSample() const { return format == SampleFormat::Int16 ? 2 : 4; }
+    int bytesPerFrame() const { return bytesPerSample() * channels; }
+
+    bool operator==(const OutputFormat& other) const {
+        return sampleRate == other.sampleRate && channels == other.channels && format == other.format;
+    }
+};
+
+// Convert samples in [-1, 1] to 16-bit, saturating anything outside that range
+inline void convertToInt16(const float* in, int16_t* out, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 lower = _mm_set1_ps(-1.0f);
+    const __m128 upper = _mm_set1_ps(1.0f);
+    for (; i + 8 <= count; i += 8) {
+        // Clamp before converting: out-of-range floats convert to INT_MIN, which packs the wrong way
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lower), upper);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lower), upper);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+                                         _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+#endif
+    for (; i < count; i++) {
+        float sample = std::max(-1.0f, std::min(1.0f, in[i]));
+        out[i] = static_cast<int16_t>(std::lrint(sample * 32767.0f));
+    }
+}
+
+// Convert samples in [-1, 1] to 32-bit, saturating anything outside that range
+inline void convertToInt32(const float* in, int32_t* out, int count) {
+    // The largest float below 2^31, so full scale never overflows the conversion
+    const float fullScale = 2147483520.0f;
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(fullScale);
+    const __m128 lower = _mm_set1_ps(-1.0f);
+    const __m128 upper = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lower), upper);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtps_epi32(_mm_mul_ps(a, scale)));
+    }
+#endif
+    for (; i < count; i++) {
+        float sample = std::max(-1.0f, std::min(1.0f, in[i]));
+        out[i] = static_cast<int32_t>(std::lrint(sample * fullScale));
+    }
+}
+
+// The output stage: turn interleaved float stereo into the output's own channel
+// layout and encoding in one pass, so nothing downstream has to convert again
+inline void convertStereoFrames(const float* stereo, int frames, const OutputFormat& format, uint8_t* out) {
+    const float* samples = stereo;
+    std::vector<float> remapped;
+    if (format.channels != SYNTH_CHANNELS) {
+        // Downmix to mono, or put the pair on the front channels of a wider layout
+        remapped.assign(static_cast<size_t>(frames) * format.channels, 0.0f);
+        for (int i = 0; i < frames; i++) {
+            float left = stereo[2 * i];
+            float right = stereo[2 * i + 1];
+            float* frame = remapped.data() + static_cast<size_t>(i) * format.channels;
+            if (format.channels == 1) {
+                frame[0] = 0.5f * (left + right);
+            } else {
+                frame[0] = left;
+                frame[1] = right;
+            }
+        }
+        samples = remapped.data();
+    }
+
+    int count = frames * format.channels;
+    switch (format.format) {
+        case SampleFormat::Float32:
+            memcpy(out, samples, static_cast<size_t>(count) * sizeof(float));
+            break;
+        case SampleFormat::Int16:
+            convertToInt16(samples, reinterpret_cast<int16_t*>(out), count);
+            break;
+        case SampleFormat::Int32:
+            convertToInt32(samples, reinterpret_cast<int32_t*>(out), count);
+            break;
+    }
+}
+
+// Positions only detune the secondary partials by a tenth of their value, so
+// snapping them to this grid is inaudible and lets nearby clicks share a note
+const double NOTE_COORDINATE_QUANTUM = 1.0 / 8192;
+
+inline long long quantizeNoteCoordinate(double value) {
+    return std::llround(value / NOTE_COORDINATE_QUANTUM);
+}
+
+// Smooth iteration counts are snapped the same way; 1/64 of an iteration moves
+// the pitch by about a cent at the default iteration cap
+const double NOTE_ITERATION_QUANTUM = 1.0 / 64;
+
+inline long long quantizeNoteIterations(double iterations) {
+    return std::llround(iterations / NOTE_ITERATION_QUANTUM);
+}
+
+// LRU cache of synthesized notes, keyed by everything the synthesis depends on.
+// Notes are stored already converted to the output format, ready to play.
+class NoteCache {
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> Buffer;
+
+    NoteCache(size_t capacity, const OutputFormat& format) : capacity(capacity), format(format) {}
+
+    // Switching formats invalidates every stored note
+    void setOutputFormat(const OutputFormat& newFormat) {
+        if (!(newFormat == format)) {
+            format = newFormat;
+            entries.clear();
+            index.clear();
+        }
+    }
+
+    // Return the note for a point, synthesizing it only on a miss
+    Buffer get(double iterations, double real, double imag, int maxIterations) {
+        Key key = { quantizeNoteIterations(iterations), maxIterations,
+                    quantizeNoteCoordinate(real), quantizeNoteCoordinate(imag) };
+        auto found = index.find(key);
+        if (found != index.end()) {
+            hits++;
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->second;
+        }
+
+        misses++;
+        TraceScope trace("audio", "note cache miss");
+        // Synthesize from the snapped position so every point in a cell sounds identical
+        std::vector<float> stereo = createMandelbrotSound(
+            key.iterations * NOTE_ITERATION_QUANTUM, key.real * NOTE_COORDINATE_QUANTUM,
+            key.imag * NOTE_COORDINATE_QUANTUM, maxIterations, format.sampleRate);
+        int frames = static_cast<int>(stereo.size() / SYNTH_CHANNELS);
+        auto bytes = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(frames) * format.bytesPerFrame());
+        convertStereoFrames(stereo.data(), frames, format, bytes->data());
+
+        Buffer buffer = bytes;
+        entries.emplace_front(key, buffer);
+        index[key] = entries.begin();
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+        return buffer;
+    }
+
+    size_t hits = 0;
+    size_t misses = 0;
+
+private:
+    struct Key {
+        long long iterations;
+        int maxIterations;
+        long long real;
+        long long imag;
+
+        bool operator==(const Key& other) const {
+            return iterations == other.iterations && maxIterations == other.maxIterations &&
+                   real == other.real && imag == other.imag;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t h = std::hash<long long>()(key.real);
+            h = h * 31 + std::hash<long long>()(key.imag);
+            h = h * 31 + std::hash<long long>()(key.iterations);
+            return h * 31 + static_cast<size_t>(key.maxIterations);
+        }
+    };
+
+    typedef std::list<std::pair<Key, Buffer>> EntryList;
+
+    size_t capacity;
+    OutputFormat format;
+    EntryList entries;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> index;
+};
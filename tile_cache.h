@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "fixed_point.h"
+#include "view.h"
+
+// Tiles of smooth iteration counts on a quadtree over the plane.
+//
+// A tile at level L is TILE_SIZE pixels across and spans 4 / 2^L units, starting
+// at a multiple of its span, so a region seen at a given zoom always maps onto
+// the same tiles however the view around it was panned. Views are drawn by
+// sampling the level whose pixel spacing is nearest their own (tile_render.h).
+
+const int TILE_SIZE = 64;
+const int TILE_SIZE_LOG2 = 6;
+const int TILE_ROOT_SPAN_LOG2 = 2;  // Level-0 tiles span 4 units
+
+// Memory the interactive app lets cached tiles use
+const size_t TILE_CACHE_BUDGET_BYTES = 128u << 20;
+
+inline FloatExp tileSpan(int level) {
+    return FloatExp(1.0, TILE_ROOT_SPAN_LOG2 - level);
+}
+
+inline FloatExp tilePixelSpacing(int level) {
+    return FloatExp(1.0, TILE_ROOT_SPAN_LOG2 - TILE_SIZE_LOG2 - level);
+}
+
+// Level whose pixel spacing is nearest the given one, within a factor of sqrt(2).
+// Negative for spacings coarser than level 0's; there are no tiles there, since a
+// wide enough view would take any number of level-0 ones (tile_render.h).
+inline int tileLevelFor(const FloatExp& pixelSpacing) {
+    double level = TILE_ROOT_SPAN_LOG2 - TILE_SIZE_LOG2 - pixelSpacing.log2();
+    return static_cast<int>(std::lround(std::max(level, -1.0)));
+}
+
+// Limbs that hold tile pixel positions at a level exactly
+inline int tileLimbs(int level) {
+    return limbsForStep(tilePixelSpacing(level), VIEW_GUARD_BITS);
+}
+
+// Corner of the tile containing a coordinate: its smallest real or imaginary value
+inline FixedPoint tileOrigin(const FixedPoint& coordinate, int level) {
+    return coordinate.withLimbs(tileLimbs(level)).floorTo(level - TILE_ROOT_SPAN_LOG2);
+}
+
+struct TileKey {
+    int level;
+    FixedPoint originReal;
+    FixedPoint originImag;
+    int maxIterations;
+    FormulaId formula;
+
+    bool operator==(const TileKey& other) const {
+        return level == other.level && maxIterations == other.maxIterations && formula == other.formula &&
+               originReal == other.originReal && originImag == other.originImag;
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& key) const {
+        size_t h = key.originReal.hash();
+        h = h * 31 + key.originImag.hash();
+        h = h * 31 + static_cast<size_t>(key.level);
+        h = h * 31 + static_cast<size_t>(key.formula);
+        return h * 31 + static_cast<size_t>(key.maxIterations);
+    }
+};
+
+// The view a tile covers, for rendering it through a KernelFrame: pixel (x, y)
+// of the tile sits at origin + (x, y) * tilePixelSpacing(level)
+inline View tileView(const TileKey& key) {
+    View view;
+    view.width = tileSpan(key.level);
+    view.height = view.width;
+    FixedPoint half = FixedPoint::fromFloatExp(view.width * 0.5, key.originReal.size());
+    view.centerReal = key.originReal + half;
+    view.centerImag = key.originImag + half;
+    return view;
+}
+
+// Least recently used tiles are dropped once the total passes a memory budget.
+// Shared between the quick and the background render, so every call locks.
+class TileCache {
+public:
+    // TILE_SIZE x TILE_SIZE smooth counts, row by row
+    typedef std::shared_ptr<const std::vector<float>> Tile;
+
+    explicit TileCache(size_t budgetBytes) : budgetBytes(budgetBytes) {}
+
+    // The cached tile, or null on a miss
+    Tile find(const TileKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->second;
+    }
+
+    // The tile last inserted at the key's level and origin, whatever maxIterations
+    // it was computed to, or null. Previews only peek, so the recency order and the
+    // hit counts are left alone.
+    Tile findAnyIterations(const TileKey& key, int* maxIterations) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = latest.find(positionOf(key));
+        if (found == latest.end()) {
+            return nullptr;
+        }
+        *maxIterations = found->second->first.maxIterations;
+        return found->second->second;
+    }
+
+    void insert(const TileKey& key, Tile tile) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index.count(key) != 0) {
+            return;
+        }
+        entries.emplace_front(key, tile);
+        index[key] = entries.begin();
+        latest[positionOf(key)] = entries.begin();
+        usedBytes += tileBytes(tile);
+        while (usedBytes > budgetBytes && entries.size() > 1) {
+            usedBytes -= tileBytes(entries.back().second);
+            auto position = latest.find(positionOf(entries.back().first));
+            if (position != latest.end() && position->second == std::prev(entries.end())) {
+                latest.erase(position);
+            }
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    size_t bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return usedBytes;
+    }
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+private:
+    static size_t tileBytes(const Tile& tile) {
+        return tile->size() * sizeof(float);
+    }
+
+    static TileKey positionOf(const TileKey& key) {
+        TileKey position = key;
+        position.maxIterations = 0;
+        return position;
+    }
+
+    typedef std::list<std::pair<TileKey, Tile>> EntryList;
+
+    size_t budgetBytes;
+    size_t usedBytes = 0;
+    std::mutex mutex;
+    EntryList entries;
+    std::unordered_map<TileKey, EntryList::iterator, TileKeyHash> index;
+    std::unordered_map<TileKey, EntryList::iterator, TileKeyHash> latest;  // By position alone
+};
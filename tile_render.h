@@ -0,0 +1,353 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "fixed_point.h"
+#include "mandelbrot.h"
+#include "render_stats.h"
+#include "tile_cache.h"
+#include "tile_store.h"
+#include "trace.h"
+#include "view.h"
+
+// Drawing views from tiles: the memory cache first, then the on-disk store,
+// and the kernel only for what neither has.
+
+// Zoom-out previews look this many levels down the cache for finer tiles
+const int PREVIEW_PYRAMID_DEPTH = 3;
+
+// and compute what none of them covers this many levels up, at a sixteenth of the pixels
+const int PREVIEW_COARSE_LEVELS = 2;
+
+// A view laid over the tiles of one level: the tile pixel nearest every screen
+// column and row, counted from the corner of the tile holding the first pixel
+struct TileGrid {
+    int level;
+    FixedPoint baseReal;
+    FixedPoint baseImag;
+    std::vector<int> sampleX;
+    std::vector<int> sampleY;
+    int columns;
+    int rows;
+
+    TileGrid(const View& view, int width, int height, int level)
+        : level(level), sampleX(width), sampleY(height) {
+        FloatExp spacing = tilePixelSpacing(level);
+        FixedPoint left = view.realAt(0, width);
+        FixedPoint top = view.imagAt(0, height);
+        baseReal = tileOrigin(left, level);
+        baseImag = tileOrigin(top, level);
+        double startX = ((left - baseReal).toFloatExp() / spacing).toDouble();
+        double startY = ((top - baseImag).toFloatExp() / spacing).toDouble();
+        double stepX = (view.width / width / spacing).toDouble();
+        double stepY = (view.height / height / spacing).toDouble();
+        for (int x = 0; x < width; x++) {
+            sampleX[x] = static_cast<int>(std::floor(startX + x * stepX + 0.5));
+        }
+        for (int y = 0; y < height; y++) {
+            sampleY[y] = static_cast<int>(std::floor(startY + y * stepY + 0.5));
+        }
+        columns = sampleX.back() / TILE_SIZE + 1;
+        rows = sampleY.back() / TILE_SIZE + 1;
+    }
+
+    TileKey key(int column, int row, int maxIterations, FormulaId formula) const {
+        int limbs = tileLimbs(level);
+        return { level, baseReal + FixedPoint::fromFloatExp(tileSpan(level) * column, limbs),
+                 baseImag + FixedPoint::fromFloatExp(tileSpan(level) * row, limbs), maxIterations, formula };
+    }
+
+    // Index of the tile, and of the pixel within it, that screen pixel (x, y) shows
+    int tileAt(int x, int y) const { return sampleY[y] / TILE_SIZE * columns + sampleX[x] / TILE_SIZE; }
+    int pixelAt(int x, int y) const { return sampleY[y] % TILE_SIZE * TILE_SIZE + sampleX[x] % TILE_SIZE; }
+};
+
+// Fill tiles (columns x rows, row by row) with the grid's tiles marked in wanted.
+// Tiles come from the cache, then the store when there is one; only the rest are
+// computed, on threadCount threads, and go into both. view is what the grid was
+// laid over, for choosing a perturbation reference. Returns false if cancel was
+// set before it finished. stats, when given, gets what was found and computed.
+inline bool loadTiles(TileCache& cache, TileStore* store, const View& view, int width, int height,
+                      const TileGrid& grid, int maxIterations, FormulaId formula, const std::vector<bool>& wanted,
+                      int threadCount, std::vector<TileCache::Tile>& tiles, const std::atomic<bool>* cancel,
+                      TileRenderStats* stats = nullptr) {
+    KernelPrecision precision =
+        formulaPrecision(choosePrecision(tilePixelSpacing(grid.level).toDouble(), maxIterations), formula);
+    std::vector<TileKey> keys;
+    std::vector<int> missing;
+    tiles.assign(grid.columns * grid.rows, nullptr);
+    TraceScope lookupTrace("render", "tile lookup", grid.level);
+    for (int i = 0; i < grid.columns * grid.rows; i++) {
+        keys.push_back(grid.key(i % grid.columns, i / grid.columns, maxIterations, formula));
+        if (!wanted[i]) {
+            continue;
+        }
+        TileCache::Tile tile = cache.find(keys[i]);
+        if (!tile && store != nullptr && (tile = store->find(keys[i], precision))) {
+            cache.insert(keys[i], tile);
+        }
+        if (!tile) {
+            missing.push_back(i);
+        } else if (stats != nullptr) {
+            stats->tilesFound++;
+        }
+        tiles[i] = tile;
+    }
+    if (missing.empty()) {
+        return true;
+    }
+    lookupTrace.setValue(static_cast<int64_t>(missing.size()));
+    ScopedTimer computeTimer(stats != nullptr ? &stats->computeMs : nullptr);
+
+    // Deep tiles all perturb around one reference orbit chosen for the whole view
+    std::shared_ptr<const ReferenceOrbit> reference;
+    if (precision == KernelPrecision::Perturbation) {
+        TraceScope trace("render", "reference orbit", maxIterations);
+        reference = KernelFrame(view, width, height, maxIterations, IMAGE_KERNEL_FEATURES, precision).reference();
+    }
+
+    // Each worker writes only its own timings, merged into stats once all are done
+    std::vector<TileTiming> timings(stats != nullptr ? missing.size() : 0);
+    std::vector<WorkerTiming> workers(stats != nullptr ? threadCount : 0);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.push_back(std::thread([&, t]() {
+            TraceScope workerTrace("render", "tile worker");
+            // Iteration totals cost an add per pixel, so only when something reads them
+            bool countIterations = stats != nullptr || Tracer::instance().enabled();
+            std::vector<EscapeResult> results(TILE_SIZE);
+            for (size_t i = next++; i < missing.size(); i = next++) {
+                if (cancel != nullptr && *cancel) {
+                    return;
+                }
+                TraceScope tileTrace("render", "tile");
+                RenderClock::time_point tileStart;
+                long long iterations = 0;
+                if (stats != nullptr) {
+                    tileStart = RenderClock::now();
+                }
+                const TileKey& key = keys[missing[i]];
+                KernelFrame frame(tileView(key), TILE_SIZE, TILE_SIZE, maxIterations, IMAGE_KERNEL_FEATURES,
+                                  precision, reference, formula);
+                auto tile = std::make_shared<std::vector<float>>(TILE_SIZE * TILE_SIZE);
+                for (int y = 0; y < TILE_SIZE; y++) {
+                    frame.renderRow(y, 0, TILE_SIZE, results.data());
+                    for (int x = 0; x < TILE_SIZE; x++) {
+                        (*tile)[y * TILE_SIZE + x] = results[x].smooth;
+                    }
+                    if (countIterations) {
+                        for (int x = 0; x < TILE_SIZE; x++) {
+                            iterations += results[x].iterations;
+                        }
+                    }
+                }
+                tileTrace.setValue(iterations);
+                tiles[missing[i]] = tile;
+                cache.insert(key, tile);
+                if (store != nullptr) {
+                    store->insert(key, precision, *tile);
+                }
+                if (stats != nullptr) {
+                    RenderClock::time_point tileEnd = RenderClock::now();
+                    timings[i] = { grid.level, t, millisecondsBetween(stats->start, tileStart),
+                                   millisecondsBetween(stats->start, tileEnd), iterations };
+                    workers[t].busyMs += millisecondsBetween(tileStart, tileEnd);
+                    workers[t].tiles++;
+                }
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (stats != nullptr) {
+        stats->workers.resize(std::max(stats->workers.size(), workers.size()));
+        for (size_t t = 0; t < workers.size(); t++) {
+            stats->workers[t].busyMs += workers[t].busyMs;
+            stats->workers[t].tiles += workers[t].tiles;
+        }
+        for (const TileTiming& timing : timings) {
+            // Tiles skipped by a cancel have no timing
+            if (timing.endMs > 0.0) {
+                stats->tiles.push_back(timing);
+                stats->tilesComputed++;
+                stats->computedPixels += TILE_SIZE * TILE_SIZE;
+            }
+        }
+    }
+    return cancel == nullptr || !*cancel;
+}
+
+// Fill counts straight from the kernel, rows shared out between threads, for views
+// coarser than the level-0 tiles. Those hold the whole set in a few hundred
+// pixels and escape at once everywhere else, so there is little to keep.
+inline bool renderUntiled(const View& view, int width, int height, int maxIterations, FormulaId formula,
+                          int threadCount, float* counts, const std::atomic<bool>* cancel,
+                          TileRenderStats* stats = nullptr) {
+    TraceScope trace("render", "untiled");
+    ScopedTimer computeTimer(stats != nullptr ? &stats->computeMs : nullptr);
+    KernelFrame frame(view, width, height, maxIterations, IMAGE_KERNEL_FEATURES, formula);
+    std::atomic<int> nextRow(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.push_back(std::thread([&]() {
+            std::vector<EscapeResult> results(width);
+            for (int y = nextRow++; y < height; y = nextRow++) {
+                if (cancel != nullptr && *cancel) {
+                    return;
+                }
+                frame.renderRow(y, 0, width, results.data());
+                for (int x = 0; x < width; x++) {
+                    counts[y * width + x] = results[x].smooth;
+                }
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return cancel == nullptr || !*cancel;
+}
+
+// Fill counts (width x height, row by row) with a view's smooth iteration
+// counts, sampled from the tiles of the level nearest its pixel spacing.
+// Returns false if cancel was set before it finished.
+inline bool renderFromTiles(TileCache& cache, TileStore* store, const View& view, int width, int height,
+                            int maxIterations, FormulaId formula, int threadCount, float* counts,
+                            const std::atomic<bool>* cancel, TileRenderStats* stats = nullptr) {
+    int level = tileLevelFor(view.width / width);
+    if (level < 0) {
+        return renderUntiled(view, width, height, maxIterations, formula, threadCount, counts, cancel, stats);
+    }
+    TileGrid grid(view, width, height, level);
+    std::vector<TileCache::Tile> tiles;
+    if (!loadTiles(cache, store, view, width, height, grid, maxIterations, formula,
+                   std::vector<bool>(grid.columns * grid.rows, true), threadCount, tiles, cancel, stats)) {
+        return false;
+    }
+    TraceScope trace("render", "sample tiles");
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            counts[y * width + x] = (*tiles[grid.tileAt(x, y)])[grid.pixelAt(x, y)];
+        }
+    }
+    return true;
+}
+
+// A count from a tile computed to tileIterations, as it would read at maxIterations.
+// Points that had not escaped by either cap are shown as inside.
+inline float previewCount(float count, int tileIterations, int maxIterations) {
+    return count >= tileIterations || count >= maxIterations ? static_cast<float>(maxIterations) : count;
+}
+
+// The tile at key pieced together from the cache's quadtree: its own level
+// first, then every other pixel of the level below, every fourth of the one
+// below that, and so on, from whatever maxIterations each was computed to.
+// NaN where nothing within PREVIEW_PYRAMID_DEPTH levels was found.
+inline std::vector<float> pyramidTile(TileCache& cache, const TileKey& key) {
+    std::vector<float> tile(TILE_SIZE * TILE_SIZE, std::numeric_limits<float>::quiet_NaN());
+    int remaining = TILE_SIZE * TILE_SIZE;
+    for (int depth = 0; depth <= PREVIEW_PYRAMID_DEPTH && remaining > 0; depth++) {
+        int parts = 1 << depth;
+        int block = TILE_SIZE >> depth;  // Pixels of this tile one finer tile covers
+        int level = key.level + depth;
+        int limbs = tileLimbs(level);
+        for (int part = 0; part < parts * parts && remaining > 0; part++) {
+            int left = part % parts * block;
+            int top = part / parts * block;
+            bool needed = false;
+            for (int y = top; y < top + block && !needed; y++) {
+                for (int x = left; x < left + block && !needed; x++) {
+                    needed = std::isnan(tile[y * TILE_SIZE + x]);
+                }
+            }
+            if (!needed) {
+                continue;
+            }
+            TileKey finer = { level,
+                              (key.originReal + FixedPoint::fromFloatExp(tileSpan(level) * (part % parts), limbs))
+                                  .withLimbs(limbs),
+                              (key.originImag + FixedPoint::fromFloatExp(tileSpan(level) * (part / parts), limbs))
+                                  .withLimbs(limbs),
+                              0, key.formula };
+            int finerIterations = 0;
+            TileCache::Tile found = cache.findAnyIterations(finer, &finerIterations);
+            if (!found) {
+                continue;
+            }
+            for (int y = 0; y < block; y++) {
+                for (int x = 0; x < block; x++) {
+                    float& pixel = tile[(top + y) * TILE_SIZE + left + x];
+                    if (std::isnan(pixel)) {
+                        pixel = previewCount((*found)[(y << depth) * TILE_SIZE + (x << depth)], finerIterations,
+                                             key.maxIterations);
+                        remaining--;
+                    }
+                }
+            }
+        }
+    }
+    return tile;
+}
+
+// A quick stand-in for renderFromTiles while zooming out: whatever finer tiles
+// earlier frames left in the cache, downsampled, and tiles PREVIEW_COARSE_LEVELS
+// levels coarser computed for the border they leave uncovered. Pixels of the
+// border show the nearest coarse tile pixel, up to a few screen pixels away, so
+// the result is only for display until renderFromTiles replaces it. Returns
+// false, having drawn nothing, at level 0 and wider, where no coarser tiles exist
+// to make the border any cheaper than the full render.
+inline bool renderPreview(TileCache& cache, TileStore* store, const View& view, int width, int height,
+                          int maxIterations, FormulaId formula, int threadCount, float* counts,
+                          TileRenderStats* stats = nullptr) {
+    TraceScope trace("render", "preview");
+    int level = tileLevelFor(view.width / width);
+    int coarseLevel = std::max(0, level - PREVIEW_COARSE_LEVELS);
+    if (coarseLevel >= level) {
+        return false;
+    }
+    TileGrid grid(view, width, height, level);
+    std::vector<std::vector<float>> tiles;
+    for (int i = 0; i < grid.columns * grid.rows; i++) {
+        tiles.push_back(pyramidTile(cache, grid.key(i % grid.columns, i / grid.columns, maxIterations, formula)));
+    }
+    bool uncovered = false;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float count = tiles[grid.tileAt(x, y)][grid.pixelAt(x, y)];
+            counts[y * width + x] = count;
+            uncovered = uncovered || std::isnan(count);
+        }
+    }
+    if (!uncovered) {
+        return true;
+    }
+
+    // The border, from whole coarse tiles, which later previews find in the cache
+    TileGrid coarse(view, width, height, coarseLevel);
+    std::vector<bool> wanted(coarse.columns * coarse.rows, false);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (std::isnan(counts[y * width + x])) {
+                wanted[coarse.tileAt(x, y)] = true;
+            }
+        }
+    }
+    std::vector<TileCache::Tile> coarseTiles;
+    loadTiles(cache, store, view, width, height, coarse, maxIterations, formula, wanted, threadCount, coarseTiles,
+              nullptr, stats);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float& count = counts[y * width + x];
+            if (std::isnan(count)) {
+                count = (*coarseTiles[coarse.tileAt(x, y)])[coarse.pixelAt(x, y)];
+            }
+        }
+    }
+    return true;
+}
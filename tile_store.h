@@ -0,0 +1,450 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fixed_point.h"
+#include "mandelbrot.h"
+#include "tile_cache.h"
+// MANDEL_NO_TILE_STORE builds without it, as the MANDEL_TILE_STORE CMake option does
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(MANDEL_NO_TILE_STORE)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TILE_STORE_SUPPORTED 1
+#endif
+
+// Tiles kept on disk between sessions, so famous locations open without
+// recomputing them.
+//
+// The file is a header followed by append-only records, each a tile key, its
+// kernel precision and the compressed counts, with a checksum over all of it.
+// Readers map the file and index it on open. A damaged record, one that fails
+// its checksum, is skipped over to the next intact one; damage with nothing
+// intact after it is a torn tail (a writer that died mid-append), which ends the
+// scan and which the next writer cuts off. Any number of
+// processes can read; the first to take an exclusive flock on the file is the
+// only writer, and readers pick up its new records on their next miss.
+//
+// Records are in native byte order; a store is not portable between machines of
+// different endianness.
+
+// Smooth counts are stored in fixed point with this many steps per iteration,
+// far finer than the colouring or the note quantum can show
+const float TILE_STORE_COUNT_SCALE = 256.0f;
+
+// Tile compression: counts become integers, each is coded as the zigzagged
+// difference from the one before as a varint, and a zero difference is
+// followed by the length of the run of zeros it starts. Inside the set every
+// count is maxIter, so whole tiles of it shrink to a few bytes.
+inline void appendVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool readVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7) {
+        uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void encodeTile(const std::vector<float>& counts, std::vector<uint8_t>& out) {
+    int64_t previous = 0;
+    for (size_t i = 0; i < counts.size();) {
+        int64_t value = std::llround(static_cast<double>(counts[i]) * TILE_STORE_COUNT_SCALE);
+        int64_t delta = value - previous;
+        appendVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        previous = value;
+        i++;
+        if (delta == 0) {
+            size_t run = 0;
+            while (i < counts.size() &&
+                   std::llround(static_cast<double>(counts[i]) * TILE_STORE_COUNT_SCALE) == previous) {
+                run++;
+                i++;
+            }
+            appendVarint(out, run);
+        }
+    }
+}
+
+inline bool decodeTile(const uint8_t* data, size_t size, std::vector<float>& counts) {
+    const uint8_t* end = data + size;
+    int64_t value = 0;
+    for (size_t i = 0; i < counts.size();) {
+        uint64_t zigzag;
+        if (!readVarint(data, end, zigzag)) {
+            return false;
+        }
+        int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        value += delta;
+        counts[i++] = static_cast<float>(value / static_cast<double>(TILE_STORE_COUNT_SCALE));
+        if (delta == 0) {
+            uint64_t run;
+            if (!readVarint(data, end, run) || run > counts.size() - i) {
+                return false;
+            }
+            std::fill(counts.begin() + i, counts.begin() + i + run, counts[i - 1]);
+            i += run;
+        }
+    }
+    return data == end;
+}
+
+class TileStore {
+public:
+    TileStore() = default;
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    ~TileStore() { close(); }
+
+    // Open or create a store. It is writable unless another process already writes it.
+    bool open(const std::string& path) {
+#if defined(TILE_STORE_SUPPORTED)
+        std::lock_guard<std::mutex> lock(mutex);
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        bool readWrite = fd >= 0;
+        if (fd < 0) {
+            fd = ::open(path.c_str(), O_RDONLY);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        writer = readWrite && flock(fd, LOCK_EX | LOCK_NB) == 0;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close();
+            return false;
+        }
+        if (info.st_size == 0 && writer) {
+            FileHeader header = { FILE_MAGIC, FILE_VERSION, TILE_SIZE, 0 };
+            if (pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+                close();
+                return false;
+            }
+        }
+        if (!scan()) {
+            close();
+            return false;
+        }
+        if (writer) {
+            // Drop a torn tail left by a writer that died mid-append; damaged records
+            // before intact ones were skipped, and stay
+            if (ftruncate(fd, static_cast<off_t>(validEnd)) != 0) {
+                close();
+                return false;
+            }
+        }
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    void close() {
+#if defined(TILE_STORE_SUPPORTED)
+        unmap();
+        if (fd >= 0) {
+            ::close(fd);  // Also releases the writer lock
+            fd = -1;
+        }
+#endif
+        index.clear();
+        validEnd = 0;
+        writer = false;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+    bool isWriter() const { return writer; }
+
+    size_t tileCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+
+    // The stored tile, or null when there is none
+    TileCache::Tile find(const TileKey& key, KernelPrecision precision) {
+#if defined(TILE_STORE_SUPPORTED)
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fd < 0) {
+            return nullptr;
+        }
+        StoreKey storeKey = { key, precision };
+        auto found = index.find(storeKey);
+        if (found == index.end() && !writer) {
+            // Another process may have written it since
+            scan();
+            found = index.find(storeKey);
+        }
+        // The writer's own recent records may lie past the mapping
+        size_t offset = found == index.end() ? 0 : found->second;
+        if (found == index.end() || !mappedThrough(offset + sizeof(RecordHeader))) {
+            return nullptr;
+        }
+        RecordHeader header;
+        memcpy(&header, mapped + offset, sizeof(header));
+        size_t keyBytes = 2 * sizeof(uint32_t) * header.limbCount;
+        if (!mappedThrough(offset + sizeof(header) + keyBytes + header.payloadBytes)) {
+            return nullptr;
+        }
+        const uint8_t* record = mapped + offset;
+        auto tile = std::make_shared<std::vector<float>>(TILE_SIZE * TILE_SIZE);
+        if (!decodeTile(record + sizeof(header) + keyBytes, header.payloadBytes, *tile)) {
+            return nullptr;
+        }
+        return tile;
+#else
+        (void)key;
+        (void)precision;
+        return nullptr;
+#endif
+    }
+
+    // Append a tile; only the writer stores anything
+    void insert(const TileKey& key, KernelPrecision precision, const std::vector<float>& counts) {
+#if defined(TILE_STORE_SUPPORTED)
+        std::lock_guard<std::mutex> lock(mutex);
+        StoreKey storeKey = { key, precision };
+        // Formulas added at run time have no id that lasts past the session
+        if (!writer || index.count(storeKey) != 0 || key.formula >= BUILTIN_FORMULA_COUNT ||
+            key.originReal.size() != key.originImag.size()) {
+            return;
+        }
+
+        std::vector<uint8_t> payload;
+        encodeTile(counts, payload);
+        RecordHeader header = {};
+        header.magic = RECORD_MAGIC;
+        header.payloadBytes = static_cast<uint32_t>(payload.size());
+        header.level = key.level;
+        header.maxIterations = key.maxIterations;
+        header.precision = static_cast<uint8_t>(precision);
+        header.formula = static_cast<uint8_t>(key.formula);
+        header.realNegative = key.originReal.isNegative();
+        header.imagNegative = key.originImag.isNegative();
+        header.limbCount = static_cast<uint32_t>(key.originReal.size());
+
+        std::vector<uint8_t> record(sizeof(header));
+        appendLimbs(record, key.originReal.limbValues());
+        appendLimbs(record, key.originImag.limbValues());
+        record.insert(record.end(), payload.begin(), payload.end());
+        header.checksum = checksum(record.data() + sizeof(header), record.size() - sizeof(header), header);
+        memcpy(record.data(), &header, sizeof(header));
+
+        if (pwrite(fd, record.data(), record.size(), static_cast<off_t>(validEnd)) !=
+            static_cast<ssize_t>(record.size())) {
+            return;
+        }
+        index[storeKey] = validEnd;
+        validEnd += record.size();
+#else
+        (void)key;
+        (void)precision;
+        (void)counts;
+#endif
+    }
+
+private:
+    static constexpr uint32_t FILE_MAGIC = 0x534C4954;    // "TILS"
+    static constexpr uint32_t FILE_VERSION = 1;
+    static constexpr uint32_t RECORD_MAGIC = 0x454C4954;  // "TILE"
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t tileSize;
+        uint32_t reserved;
+    };
+
+    // Followed by the real then imaginary origin limbs, then the payload
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t payloadBytes;
+        int32_t level;
+        int32_t maxIterations;
+        uint8_t precision;
+        uint8_t realNegative;
+        uint8_t imagNegative;
+        uint8_t formula;  // A BuiltinFormula; 0, z^2 + c, in records from before there were others
+        uint32_t limbCount;  // Per coordinate
+        uint32_t checksum;   // Of the header's other fields and everything after it
+    };
+
+    struct StoreKey {
+        TileKey tile;
+        KernelPrecision precision;
+
+        bool operator==(const StoreKey& other) const { return tile == other.tile && precision == other.precision; }
+    };
+
+    struct StoreKeyHash {
+        size_t operator()(const StoreKey& key) const {
+            return TileKeyHash()(key.tile) * 31 + static_cast<size_t>(key.precision);
+        }
+    };
+
+    static void appendLimbs(std::vector<uint8_t>& out, const std::vector<uint32_t>& limbs) {
+        size_t at = out.size();
+        out.resize(at + limbs.size() * sizeof(uint32_t));
+        memcpy(out.data() + at, limbs.data(), limbs.size() * sizeof(uint32_t));
+    }
+
+    // FNV-1a over the header (checksum field zeroed) and the body
+    static uint32_t checksum(const uint8_t* body, size_t size, RecordHeader header) {
+        header.checksum = 0;
+        uint32_t hash = 2166136261u;
+        auto mix = [&hash](const uint8_t* data, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                hash = (hash ^ data[i]) * 16777619u;
+            }
+        };
+        mix(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+        mix(body, size);
+        return hash;
+    }
+
+#if defined(TILE_STORE_SUPPORTED)
+    // Map the whole file as it is now
+    bool map() {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        if (size == mappedBytes) {
+            return mapped != nullptr;
+        }
+        unmap();
+        if (size == 0) {
+            return false;
+        }
+        void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        mapped = static_cast<const uint8_t*>(address);
+        mappedBytes = size;
+        return true;
+    }
+
+    bool mappedThrough(size_t bytes) {
+        return bytes <= mappedBytes || (map() && bytes <= mappedBytes);
+    }
+
+    void unmap() {
+        if (mapped != nullptr) {
+            munmap(const_cast<uint8_t*>(mapped), mappedBytes);
+            mapped = nullptr;
+            mappedBytes = 0;
+        }
+    }
+
+    // Index records from where the last scan stopped; false if this is no tile store
+    bool scan() {
+        if (!map()) {
+            return false;
+        }
+        if (validEnd == 0) {
+            FileHeader header;
+            if (mappedBytes < sizeof(header)) {
+                return false;
+            }
+            memcpy(&header, mapped, sizeof(header));
+            if (header.magic != FILE_MAGIC || header.version != FILE_VERSION || header.tileSize != TILE_SIZE) {
+                return false;
+            }
+            validEnd = sizeof(header);
+        }
+        while (validEnd + sizeof(RecordHeader) <= mappedBytes) {
+            size_t recordBytes = intactRecordBytes(validEnd);
+            if (recordBytes == 0) {
+                size_t next = nextIntactRecord(validEnd);
+                if (next == 0) {
+                    // A torn tail, or a record another process is still appending
+                    break;
+                }
+                validEnd = next;
+                continue;
+            }
+            RecordHeader header;
+            memcpy(&header, mapped + validEnd, sizeof(header));
+            size_t keyBytes = 2 * sizeof(uint32_t) * static_cast<size_t>(header.limbCount);
+            const uint8_t* body = mapped + validEnd + sizeof(header);
+            std::vector<uint32_t> real(header.limbCount), imag(header.limbCount);
+            memcpy(real.data(), body, keyBytes / 2);
+            memcpy(imag.data(), body + keyBytes / 2, keyBytes / 2);
+            StoreKey key = { { header.level, FixedPoint::fromLimbs(header.realNegative != 0, real),
+                               FixedPoint::fromLimbs(header.imagNegative != 0, imag), header.maxIterations,
+                               header.formula },
+                             static_cast<KernelPrecision>(header.precision) };
+            index[key] = validEnd;
+            validEnd += recordBytes;
+        }
+        return true;
+    }
+
+    // Size of the record at offset if it is whole and passes its checksum, else 0
+    size_t intactRecordBytes(size_t offset) const {
+        if (offset + sizeof(RecordHeader) > mappedBytes) {
+            return 0;
+        }
+        RecordHeader header;
+        memcpy(&header, mapped + offset, sizeof(header));
+        size_t bodyBytes = 2 * sizeof(uint32_t) * static_cast<size_t>(header.limbCount) + header.payloadBytes;
+        if (header.magic != RECORD_MAGIC || header.limbCount < FixedPoint::MIN_LIMBS ||
+            bodyBytes > mappedBytes - offset - sizeof(header) ||
+            checksum(mapped + offset + sizeof(header), bodyBytes, header) != header.checksum) {
+            return 0;
+        }
+        return sizeof(header) + bodyBytes;
+    }
+
+    // Start of the first intact record after a damaged one at offset, or 0 if none
+    // follows: where its length says it ends when that can be trusted, otherwise the
+    // next record magic that begins an intact record
+    size_t nextIntactRecord(size_t offset) const {
+        RecordHeader header;
+        memcpy(&header, mapped + offset, sizeof(header));
+        size_t end = offset + sizeof(header) + 2 * sizeof(uint32_t) * static_cast<size_t>(header.limbCount) +
+                     header.payloadBytes;
+        if (header.magic == RECORD_MAGIC && end > offset + sizeof(header) && end < mappedBytes &&
+            intactRecordBytes(end) != 0) {
+            return end;
+        }
+        for (size_t at = offset + 1; at + sizeof(RecordHeader) <= mappedBytes; at++) {
+            uint32_t magic;
+            memcpy(&magic, mapped + at, sizeof(magic));
+            if (magic == RECORD_MAGIC && intactRecordBytes(at) != 0) {
+                return at;
+            }
+        }
+        return 0;
+    }
+#endif
+
+    std::mutex mutex;
+    int fd = -1;
+    bool writer = false;
+    const uint8_t* mapped = nullptr;
+    size_t mappedBytes = 0;
+    size_t validEnd = 0;  // End of the last intact record; past it is at most a torn tail
+    std::unordered_map<StoreKey, size_t, StoreKeyHash> index;  // Record offsets
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timelines of what every thread did, written as Chrome trace event JSON for
+// chrome://tracing or ui.perfetto.dev.
+//
+// Each thread records into a buffer of its own, so recording takes no lock: the
+// owner appends an event and publishes the new count, and a dump reads up to the
+// count it sees. Buffers are rings that keep the latest events; a dump drops any
+// slot it finds the owner has started overwriting since. Threads come and
+// go with every render, so a thread hands its buffer back to a pool when it
+// exits and the next new thread takes it over; a buffer is a lane in the trace,
+// and concurrent workers show as parallel lanes. While tracing is off a scope
+// costs one relaxed atomic load.
+
+// Events each lane keeps before the oldest are overwritten
+const size_t TRACE_BUFFER_EVENTS = 1 << 15;
+
+struct TraceEvent {
+    const char* category;  // String literals only, so events need no allocation
+    const char* name;
+    int64_t startNs;
+    int64_t durationNs;
+    int64_t value;  // Shown as an argument when not negative
+};
+
+// One event of a ring, field by field, so a dump may read it while the owner overwrites it;
+// a copy torn that way is detected from the buffer's count and dropped
+struct TraceSlot {
+    std::atomic<const char*> category{nullptr};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> startNs{0};
+    std::atomic<int64_t> durationNs{0};
+    std::atomic<int64_t> value{0};
+
+    void store(const TraceEvent& event) {
+        category.store(event.category, std::memory_order_relaxed);
+        name.store(event.name, std::memory_order_relaxed);
+        startNs.store(event.startNs, std::memory_order_relaxed);
+        durationNs.store(event.durationNs, std::memory_order_relaxed);
+        value.store(event.value, std::memory_order_relaxed);
+    }
+
+    TraceEvent load() const {
+        return { category.load(std::memory_order_relaxed), name.load(std::memory_order_relaxed),
+                 startNs.load(std::memory_order_relaxed), durationNs.load(std::memory_order_relaxed),
+                 value.load(std::memory_order_relaxed) };
+    }
+};
+
+struct TraceBuffer {
+    TraceBuffer(int lane) : lane(lane), events(TRACE_BUFFER_EVENTS) {}
+
+    int lane;
+    std::atomic<const char*> name{nullptr};  // Set by long-lived threads; null for pooled workers
+    std::vector<TraceSlot> events;
+    std::atomic<uint64_t> written{0};
+
+    // Only the owning thread calls this. The fence orders the count that says the
+    // slot is about to be reused before any of the new fields, so a dump that reads
+    // one of them also sees that count afterwards.
+    void record(const TraceEvent& event) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        events[index % events.size()].store(event);
+        written.store(index + 1, std::memory_order_release);
+    }
+};
+
+class Tracer {
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const { return isEnabled.load(std::memory_order_relaxed); }
+
+    // Record from now on; earlier events are left out of later dumps
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        sessionStartNs = now();
+        isEnabled = true;
+    }
+
+    void stop() { isEnabled = false; }
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    TraceBuffer* acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pool.empty()) {
+            TraceBuffer* buffer = pool.back();
+            pool.pop_back();
+            return buffer;
+        }
+        buffers.push_back(std::make_unique<TraceBuffer>(static_cast<int>(buffers.size())));
+        return buffers.back().get();
+    }
+
+    void release(TraceBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer->name = nullptr;
+        pool.push_back(buffer);
+    }
+
+    // Every event recorded since start(), as a Chrome trace JSON document
+    void writeJson(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        auto separator = [&]() {
+            out << (first ? "\n" : ",\n");
+            first = false;
+        };
+        for (const auto& buffer : buffers) {
+            separator();
+            const char* named = buffer->name;
+            std::string name = named != nullptr ? named : "pool " + std::to_string(buffer->lane);
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->lane
+                << ",\"args\":{\"name\":\"" << name << "\"}}";
+
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t size = buffer->events.size();
+            uint64_t begin = written > size ? written - size : 0;
+            for (uint64_t i = begin; i < written; i++) {
+                TraceEvent event = buffer->events[i % size].load();
+                // Once the owner has reached event i + size it may have written part of
+                // the copy over; the event is gone from the ring either way
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint64_t writtenNow = buffer->written.load(std::memory_order_relaxed);
+                if (i + size <= writtenNow || event.startNs < sessionStartNs) {
+                    continue;
+                }
+                separator();
+                out << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->lane
+                    << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0;
+                if (event.value >= 0) {
+                    out << ",\"args\":{\"value\":" << event.value << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+private:
+    Tracer() : origin(std::chrono::steady_clock::now()) {}
+
+    std::atomic<bool> isEnabled{false};
+    int64_t sessionStartNs = 0;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex mutex;  // Guards the buffer list and the pool, never recording
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::vector<TraceBuffer*> pool;
+};
+
+// The calling thread's buffer, taken from the pool on first use and handed back on exit
+inline TraceBuffer* traceBuffer() {
+    struct ThreadBuffer {
+        TraceBuffer* buffer = nullptr;
+        ~ThreadBuffer() {
+            if (buffer != nullptr) {
+                Tracer::instance().release(buffer);
+            }
+        }
+    };
+    thread_local ThreadBuffer thread;
+    if (thread.buffer == nullptr) {
+        thread.buffer = Tracer::instance().acquire();
+    }
+    return thread.buffer;
+}
+
+// Name the calling thread's lane, with a string literal; for threads that live as long as the program
+inline void traceThreadName(const char* name) {
+    if (Tracer::instance().enabled()) {
+        traceBuffer()->name = name;
+    }
+}
+
+// One event from construction to the end of the scope, recorded if tracing was
+// on when it began. category and name must be string literals.
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name, int64_t value = -1)
+        : TraceScope(nullptr, category, name, value) {}
+
+    // Into a buffer the caller acquired beforehand, for threads that must never
+    // wait on the tracer's lock or allocate, such as a real-time audio callback
+    TraceScope(TraceBuffer* buffer, const char* category, const char* name, int64_t value = -1)
+        : active(Tracer::instance().enabled()), buffer(buffer) {
+        if (active) {
+            event = { category, name, Tracer::instance().now(), 0, value };
+        }
+    }
+
+    ~TraceScope() {
+        if (active) {
+            event.durationNs = Tracer::instance().now() - event.startNs;
+            (buffer != nullptr ? buffer : traceBuffer())->record(event);
+        }
+    }
+
+    // An argument known only once the work is done, such as an iteration total
+    void setValue(int64_t value) { event.value = value; }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    bool active;
+    TraceBuffer* buffer;
+    TraceEvent event;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <memory>
+#include "double_double.h"
+#include "fixed_point.h"
+#include "mandelbrot.h"
+#include "perturbation.h"
+
+// Bits of a view's center kept below its width: enough for any screen size
+// plus a margin for the sums that move the center around
+const int VIEW_GUARD_BITS = 64;
+
+// The part of the plane on screen. The center is fixed point with as many limbs
+// as the zoom needs, so deep views stay where they were aimed; the extent only
+// ever needs relative precision, with an exponent that outruns doubles.
+struct View {
+    FixedPoint centerReal;
+    FixedPoint centerImag;
+    FloatExp width;
+    FloatExp height;
+
+    static View around(double real, double imag, double width, double height) {
+        View view;
+        view.width = FloatExp(width);
+        view.height = FloatExp(height);
+        view.centerReal = FixedPoint::fromDouble(real, view.limbs());
+        view.centerImag = FixedPoint::fromDouble(imag, view.limbs());
+        return view;
+    }
+
+    // Limbs a point needs to sit well under a pixel apart from its neighbours
+    int limbs() const { return limbsForStep(width, VIEW_GUARD_BITS); }
+
+    // Plane coordinates of a screen position, in pixels from the top-left corner
+    FixedPoint realAt(double x, int screenWidth) const {
+        return centerReal + FixedPoint::fromFloatExp(width * (x / screenWidth - 0.5), limbs());
+    }
+
+    FixedPoint imagAt(double y, int screenHeight) const {
+        return centerImag + FixedPoint::fromFloatExp(height * (y / screenHeight - 0.5), limbs());
+    }
+
+    // Where another view's center lies from this one's, in widths and heights of this view
+    double widthsTo(const View& other) const { return ((other.centerReal - centerReal).toFloatExp() / width).toDouble(); }
+    double heightsTo(const View& other) const { return ((other.centerImag - centerImag).toFloatExp() / height).toDouble(); }
+
+    bool operator==(const View& other) const {
+        return centerReal == other.centerReal && centerImag == other.centerImag &&
+               width == other.width && height == other.height;
+    }
+
+    bool operator!=(const View& other) const { return !(*this == other); }
+};
+
+// A view laid over a pixel grid, in the coordinates its precision works in:
+// double-double pixel positions for the row kernels, or a reference orbit and
+// pixel offsets from it for perturbation
+class KernelFrame {
+public:
+    KernelFrame(const View& view, int screenWidth, int screenHeight, int maxIterations, unsigned features,
+                FormulaId formula = FORMULA_MANDELBROT)
+        : KernelFrame(view, screenWidth, screenHeight, maxIterations, features,
+                      choosePrecision((view.width / screenWidth).toDouble(), maxIterations), nullptr, formula) {}
+
+    // The Julia set of c over the view. Perturbation follows offsets in c, which is
+    // fixed here, so Julia views go no deeper than double-double.
+    KernelFrame(const View& view, int screenWidth, int screenHeight, int maxIterations, unsigned features,
+                const JuliaParameter& c, FormulaId formula = FORMULA_MANDELBROT)
+        : KernelFrame(view, screenWidth, screenHeight, maxIterations, features | KERNEL_JULIA,
+                      std::min(choosePrecision((view.width / screenWidth).toDouble(), maxIterations),
+                               KernelPrecision::DoubleDouble), nullptr, formula) {
+        julia = c;
+    }
+
+    // reference, when given, is a perturbation reference orbit to the same maxIterations
+    // to reuse, so pieces of one larger view can share the orbit computed for all of it.
+    // Formulas without perturbation stop at double-double whatever precision asks for.
+    KernelFrame(const View& view, int screenWidth, int screenHeight, int maxIterations, unsigned features,
+                KernelPrecision precision, std::shared_ptr<const ReferenceOrbit> reference = nullptr,
+                FormulaId formula = FORMULA_MANDELBROT)
+        : kernelPrecision(formulaPrecision(precision, formula)), maxIterations(maxIterations), kernel(nullptr) {
+        FloatExp realStep = view.width / screenWidth;
+        FloatExp imagStep = view.height / screenHeight;
+        if (kernelPrecision == KernelPrecision::Perturbation) {
+            if (reference) {
+                orbit = reference;
+                referenceX = ((orbit->pointReal - view.realAt(0, screenWidth)).toFloatExp() / realStep).toDouble();
+                referenceY = ((orbit->pointImag - view.imagAt(0, screenHeight)).toFloatExp() / imagStep).toDouble();
+            } else {
+                chooseReference(view, screenWidth, screenHeight);
+            }
+            step = realStep;
+            imagScale = (imagStep / realStep).toDouble();
+        } else {
+            kernel = selectKernel(kernelPrecision, features, formula);
+            realStart = view.realAt(0, screenWidth).toDoubleDouble();
+            imagStart = view.imagAt(0, screenHeight).toDoubleDouble();
+            realStepDouble = realStep.toDouble();
+            imagStepDouble = imagStep.toDouble();
+        }
+    }
+
+    KernelPrecision precision() const { return kernelPrecision; }
+
+    // The perturbation reference orbit, null for the row kernels
+    std::shared_ptr<const ReferenceOrbit> reference() const { return orbit; }
+
+    // count pixels of row y, starting at column x
+    void renderRow(int y, int x, int count, EscapeResult* results) const {
+        if (kernel != nullptr) {
+            kernel(realStart + x * realStepDouble, realStepDouble, imagStart + y * imagStepDouble, julia, count,
+                   maxIterations, results);
+        } else {
+            perturbationRow(*orbit, step, x - referenceX, (y - referenceY) * imagScale, count, maxIterations, results);
+        }
+    }
+
+private:
+    // An orbit that escapes long before the pixels around it leaves their offsets
+    // nothing to follow, so fall back to the longest-lived of a grid of pixels
+    void chooseReference(const View& view, int screenWidth, int screenHeight) {
+        auto candidate = [&](int x, int y) {
+            auto found = std::make_shared<ReferenceOrbit>(computeReferenceOrbit(
+                view.realAt(x, screenWidth), view.imagAt(y, screenHeight), maxIterations));
+            if (!orbit || found->escapeIteration > orbit->escapeIteration) {
+                orbit = found;
+                referenceX = x;
+                referenceY = y;
+            }
+        };
+        candidate(screenWidth / 2, screenHeight / 2);
+        for (int i = 0; i < REFERENCE_CANDIDATE_GRID * REFERENCE_CANDIDATE_GRID; i++) {
+            if (orbit->escapeIteration >= maxIterations) {
+                break;
+            }
+            candidate((i % REFERENCE_CANDIDATE_GRID * 2 + 1) * screenWidth / (2 * REFERENCE_CANDIDATE_GRID),
+                      (i / REFERENCE_CANDIDATE_GRID * 2 + 1) * screenHeight / (2 * REFERENCE_CANDIDATE_GRID));
+        }
+    }
+
+    KernelPrecision kernelPrecision;
+    int maxIterations;
+
+    // Row kernels
+    RowKernel kernel;
+    JuliaParameter julia = {};
+    DoubleDouble realStart;
+    DoubleDouble imagStart;
+    double realStepDouble = 0.0;
+    double imagStepDouble = 0.0;
+
+    // Perturbation, shared by copies of the frame handed to worker threads
+    std::shared_ptr<const ReferenceOrbit> orbit;
+    FloatExp step;
+    double referenceX = 0.0;  // Pixel position of the reference point
+    double referenceY = 0.0;
+    double imagScale = 1.0;  // Vertical pixel spacing in horizontal ones
+};
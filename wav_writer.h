@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Streaming writer for 16-bit PCM WAV files.
+// The header is written up front with placeholder sizes and patched on close,
+// so arbitrarily long renders never have to be held in memory.
+class WavWriter {
+public:
+    ~WavWriter() { close(); }
+
+    bool open(const char* path, int sampleRate, int channels) {
+        close();
+        file = (path[0] == '-' && path[1] == '\0') ? stdout : fopen(path, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        this->sampleRate = sampleRate;
+        this->channels = channels;
+        dataBytes = 0;
+        return writeHeader();
+    }
+
+    bool write(const int16_t* samples, size_t count) {
+        bytes.resize(count * 2);
+        for (size_t i = 0; i < count; i++) {
+            uint16_t v = static_cast<uint16_t>(samples[i]);
+            bytes[2 * i] = static_cast<unsigned char>(v);
+            bytes[2 * i + 1] = static_cast<unsigned char>(v >> 8);
+        }
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        dataBytes += static_cast<uint32_t>(count * sizeof(int16_t));
+        return ferror(file) == 0;
+    }
+
+    // Patch the chunk sizes and close the file; returns false on any write error
+    bool close() {
+        if (file == nullptr) {
+            return true;
+        }
+        // Sizes can only be patched on seekable outputs; streamed WAVs keep the placeholders
+        if (fseek(file, 0, SEEK_SET) == 0) {
+            writeHeader();
+        }
+        bool ok = ferror(file) == 0;
+        if (file != stdout) {
+            ok = fclose(file) == 0 && ok;
+        } else {
+            fflush(file);
+        }
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    bool writeHeader() {
+        uint32_t dataSize = dataBytes ? dataBytes : 0xFFFFFFFFu - 36;
+        fwrite("RIFF", 1, 4, file);
+        writeU32(36 + dataSize);
+        fwrite("WAVEfmt ", 1, 8, file);
+        writeU32(16);                                  // fmt chunk size
+        writeU16(1);                                   // PCM
+        writeU16(static_cast<uint16_t>(channels));
+        writeU32(static_cast<uint32_t>(sampleRate));
+        writeU32(static_cast<uint32_t>(sampleRate * channels * 2));
+        writeU16(static_cast<uint16_t>(channels * 2)); // Block align
+        writeU16(16);                                  // Bits per sample
+        fwrite("data", 1, 4, file);
+        writeU32(dataSize);
+        return ferror(file) == 0;
+    }
+
+    // WAV is little-endian regardless of the host
+    void writeU16(uint16_t v) {
+        unsigned char b[2] = { static_cast<unsigned char>(v), static_cast<unsigned char>(v >> 8) };
+        fwrite(b, 1, 2, file);
+    }
+
+    void writeU32(uint32_t v) {
+        writeU16(static_cast<uint16_t>(v));
+        writeU16(static_cast<uint16_t>(v >> 16));
+    }
+
+    FILE* file = nullptr;
+    int sampleRate = 0;
+    int channels = 0;
+    uint32_t dataBytes = 0;
+    std::vector<unsigned char> bytes;
+};